@@ -0,0 +1,87 @@
+/*
+ * Benchmark driver: runs the thread of the variant and reports the average
+ * number of cycles spent in resume and in yield over BENCH_CALLS calls.
+ * The report goes to USART0, one line starting with "BENCH".
+ * Then the MCU sleeps with interrupts disabled, which ends the simavr run.
+ */
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "bench.h"
+
+#define BENCH_CALLS 64
+#define BENCH_BAUD  38400
+
+volatile uint16_t bench_resumed;
+volatile uint16_t bench_yielding;
+volatile uint8_t bench_sink;
+
+
+static void put(char c) {
+  while (!(UCSR0A & _BV(UDRE0)));
+  UDR0 = c;
+}
+
+static void put_string(const char *s) {
+  while (*s) put(*s++);
+}
+
+static void put_number(uint16_t n) {
+  char digits[5];
+  uint8_t i = 0;
+  do {
+    digits[i++] = '0' + n % 10;
+    n /= 10;
+  } while (n);
+  while (i) put(digits[--i]);
+}
+
+/* Print the average of the sum over BENCH_CALLS, with one decimal. */
+static void put_average(const char *name, uint32_t sum) {
+  uint16_t tenths = (uint16_t)(sum * 10 / BENCH_CALLS);
+  put(' ');
+  put_string(name);
+  put('=');
+  put_number(tenths / 10);
+  put('.');
+  put('0' + tenths % 10);
+}
+
+
+int main(void) {
+  UBRR0 = F_CPU / 16 / BENCH_BAUD - 1;
+  UCSR0B = _BV(TXEN0);
+  TCCR1B = _BV(CS10);
+
+  bench_init();
+  bench_thread();
+
+  uint16_t t0 = TCNT1;
+  bench_resumed = TCNT1;
+  uint16_t stamp = bench_resumed - t0;
+
+  uint32_t resume = 0;
+  uint32_t yield = 0;
+  for (uint8_t i = 0; i < BENCH_CALLS; i++) {
+    t0 = TCNT1;
+    bench_thread();
+    uint16_t t3 = TCNT1;
+    resume += (uint16_t)(bench_resumed - t0 - stamp);
+    yield += (uint16_t)(t3 - bench_yielding - stamp);
+  }
+
+  put_string("BENCH ");
+  put_string(bench_variant);
+  put_average("resume", resume);
+  put_average("yield", yield);
+  put_string(" ram=");
+  put_number(bench_ip_ram);
+  put('\n');
+  while (!(UCSR0A & _BV(TXC0)));
+
+  cli();
+  sleep_enable();
+  sleep_cpu();
+  return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+/**
+ * \file
+ * Context switch benchmark harness.
+ *
+ * Every variant implements the same workload: one thread function with BENCH_YIELDS segments,
+ * each segment doing a little work between a resume point and a yield point.
+ * Timer 1 runs at the CPU clock and serves as a cycle counter:
+ * the time from the call of the thread function to its resume point,
+ * and from its yield point to the return, are accumulated by bench.c.
+ * \author semicontinuity
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+
+#ifndef BENCH_YIELDS
+#define BENCH_YIELDS 8
+#endif
+
+
+/** The name of the variant, printed in the report. */
+extern const char bench_variant[];
+
+/** The number of RAM bytes used by the instruction pointer of the thread. */
+extern const uint8_t bench_ip_ram;
+
+/** Initialize the thread of the variant. */
+void bench_init(void);
+
+/**
+ * The thread function of the variant.
+ * With BENCH_HIGH_FLASH, it is placed in the section .bench_high, which run.sh links above 128 KB.
+ */
+#ifdef BENCH_HIGH_FLASH
+void bench_thread(void) __attribute__((section(".bench_high")));
+#else
+void bench_thread(void);
+#endif
+
+
+extern volatile uint16_t bench_resumed;
+extern volatile uint16_t bench_yielding;
+extern volatile uint8_t bench_sink;
+
+#define BENCH_RESUMED()  do { bench_resumed = TCNT1; } while(0)
+#define BENCH_YIELDING() do { bench_yielding = TCNT1; } while(0)
+#define BENCH_WORK()     do { bench_sink++; } while(0)
+
+/**
+ * One segment of the workload; the variant provides the yield statement.
+ * Must be used one per line, since yields may be numbered with __LINE__.
+ */
+#define BENCH_SEGMENT(yield) BENCH_RESUMED(); BENCH_WORK(); BENCH_YIELDING(); yield
+
+#endif
@@ -0,0 +1,118 @@
+#!/bin/sh
+#
+# Context switch benchmark.
+#
+# Builds the same workload with every instruction pointer placement of vthreads.h,
+# with classic Protothreads local continuations and with a plain switch state machine,
+# runs each build under simavr and prints, per variant:
+#   resume  - cycles from the call of the thread function to its resume point
+#   yield   - cycles from the yield point to the return to the caller
+#   flash   - bytes of code per yield point (from the thread function size at 4 and 8 yield points,
+#             plus, for the compact instruction pointer, the 2-byte jump table entries in .progmem.vthreads.bench)
+#   ram     - bytes of RAM per thread instruction pointer
+#
+# Usage: run.sh [--save FILE | --check FILE]
+#   --save FILE   store the results as a baseline
+#   --check FILE  fail if any variant got slower or bigger than in the baseline
+#
+# Then prints the yield-point map of the vt-ram workload (see tools/vt_map.py).
+#
+# The variants of the far instruction pointer are built for MCU_LARGE, with the thread code
+# either in the low 128 KB or linked above it (where ordinary continuations go through trampolines).
+#
+# Environment: CC (avr-gcc), NM (avr-nm), OBJDUMP (avr-objdump), SIMAVR (simavr), MCU (atmega328p),
+#              MCU_LARGE (atmega2560), F_CPU (16000000), OPT (-Os)
+
+set -e
+
+CC=${CC:-avr-gcc}
+NM=${NM:-avr-nm}
+OBJDUMP=${OBJDUMP:-avr-objdump}
+SIMAVR=${SIMAVR:-simavr}
+MCU=${MCU:-atmega328p}
+MCU_LARGE=${MCU_LARGE:-atmega2560}
+F_CPU=${F_CPU:-16000000}
+OPT=${OPT:--Os}
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+OUT=${OUT:-$HERE/out}
+CFLAGS="-DF_CPU=${F_CPU}UL $OPT -std=gnu99 -I$HERE/../include -I$HERE"
+HIGH_FLASH="-DBENCH_HIGH_FLASH -Wl,--section-start=.bench_high=0x20000"
+
+mkdir -p "$OUT"
+RESULTS="$OUT/results.txt"
+: > "$RESULTS"
+
+# thread_size <elf>: the size of bench_thread and of its jump table (bench__COUNT entries, if any)
+thread_size() {
+  set -- $($NM -S "$1" | awk '
+    $4 == "bench_thread" { code = $2 }
+    $3 == "bench__COUNT" { count = $1 }
+    END { print "0x" code, "0x" (count == "" ? "0" : count) }')
+  echo $(( $1 + 2 * $2 ))
+}
+
+# bench <variant> <source> [compiler flags...], for the device $mcu
+mcu=$MCU
+bench() {
+  name=$1; source=$2; shift 2
+  for yields in 4 8; do
+    $CC -mmcu=$mcu $CFLAGS "$@" -DBENCH_VARIANT="\"$name\"" -DBENCH_YIELDS=$yields \
+      -o "$OUT/$name-$yields.elf" "$HERE/bench.c" "$HERE/$source"
+  done
+  size4=$(thread_size "$OUT/$name-4.elf")
+  size8=$(thread_size "$OUT/$name-8.elf")
+  flash=$(( (size8 - size4) / 4 ))
+  report=$($SIMAVR -m "$mcu" -f "$F_CPU" "$OUT/$name-8.elf" 2>&1 | sed -n 's/.*BENCH //p')
+  echo "$report flash=$flash" >> "$RESULTS"
+}
+
+bench vt-ram            vthreads.c
+bench vt-ram-direct     vthreads.c -DVT_DIRECT_YIELD
+bench vt-gpior          vthreads.c -DBENCH_IP_GPIOR
+bench vt-reg            vthreads.c -DBENCH_IP_REG='"r4"' -ffixed-r4 -ffixed-r5
+bench vt-high-reg       vthreads.c -DBENCH_IP_REG='"r16"' -ffixed-r16 -ffixed-r17
+bench vt-z              vthreads.c -DBENCH_IP_Z -ffixed-r30 -ffixed-r31
+bench vt-z-direct       vthreads.c -DBENCH_IP_Z -DVT_DIRECT_YIELD -ffixed-r30 -ffixed-r31
+bench vt-ip8            vthreads.c -DBENCH_IP8
+bench vt-ip8-gpior      vthreads.c -DBENCH_IP8 -DBENCH_IP_GPIOR
+bench protothreads      switch.c -DBENCH_PROTOTHREADS
+bench switch            switch.c
+
+mcu=$MCU_LARGE
+bench vt-ram-low        vthreads.c
+bench vt-ram-high       vthreads.c $HIGH_FLASH
+bench vt-ip24-high      vthreads.c -DBENCH_IP24 $HIGH_FLASH
+
+# Lines look like: <variant> resume=<x> yield=<y> ram=<r> flash=<f>
+awk '{
+  printf "%-16s", $1
+  for (i = 2; i <= NF; i++) { split($i, kv, "="); printf "  %s=%-6s", kv[1], kv[2] }
+  printf "\n"
+}' "$RESULTS"
+
+$CC -mmcu=$MCU $CFLAGS -DVT_MAP -DBENCH_VARIANT='"vt-map"' -DBENCH_YIELDS=8 \
+  -o "$OUT/vt-map.elf" "$HERE/bench.c" "$HERE/vthreads.c"
+echo
+python3 "$HERE/../tools/vt_map.py" --objdump "$OBJDUMP" "$OUT/vt-map.elf"
+
+case "$1" in
+  --save)
+    cp "$RESULTS" "$2"
+    ;;
+  --check)
+    awk '
+      function values(line, v,   n, f, i, kv) {
+        n = split(line, f, " ")
+        for (i = 2; i <= n; i++) { split(f[i], kv, "="); v[kv[1]] = kv[2] + 0 }
+      }
+      NR == FNR { base[$1] = $0; next }
+      ($1 in base) {
+        delete b; delete c
+        values(base[$1], b); values($0, c)
+        for (k in b) if (c[k] > b[k]) { printf "%s: %s regressed from %s to %s\n", $1, k, b[k], c[k]; failed = 1 }
+      }
+      END { exit failed }
+    ' "$2" "$RESULTS"
+    ;;
+esac
@@ -0,0 +1,29 @@
+/*
+ * The workload as a switch-based state machine.
+ *  - BENCH_PROTOTHREADS  classic Protothreads local continuations: the state is the __LINE__ of the yield point
+ *  - (none)              a plain state machine with dense state numbers
+ */
+#include <stdint.h>
+#include <avr/io.h>
+#include "bench.h"
+
+const char bench_variant[] = BENCH_VARIANT;
+
+#if defined(BENCH_PROTOTHREADS)
+unsigned short bench_ip;
+#define WL_STATE(n) __LINE__
+#else
+uint8_t bench_ip;
+#define WL_STATE(n) (n)
+#endif
+const uint8_t bench_ip_ram = sizeof(bench_ip);
+
+#define WL_BEGIN(thread, ip)    switch (ip) { case 0: for (;;) {
+#define WL_YIELD(thread, ip, n) do { (ip) = WL_STATE(n); return; case WL_STATE(n):; } while(0)
+#define WL_END(thread)          } }
+
+void bench_init(void) {
+  bench_ip = 0;
+}
+
+#include "workload.h"
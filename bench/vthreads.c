@@ -0,0 +1,73 @@
+/*
+ * The workload on vthreads.h.
+ * The placement of the instruction pointer is selected with one of:
+ *  - (none)            RAM
+ *  - BENCH_IP_GPIOR    GPIOR1:GPIOR2 (GPIOR0 for the compact instruction pointer)
+ *  - BENCH_IP_REG=rN   a global register variable; compile everything with -ffixed for both registers
+ *  - BENCH_IP_Z        r30:r31 with VT_IP_Z and VT_BEGIN_Z; compile everything with -ffixed-r30 -ffixed-r31
+ * Define BENCH_IP8 to use the compact instruction pointer, BENCH_IP24 for the far instruction pointer
+ * (devices with EIND), VT_DIRECT_YIELD for the flag-free yield.
+ */
+#include <stdint.h>
+#include <avr/io.h>
+#include "vthreads.h"
+#include "bench.h"
+
+const char bench_variant[] = BENCH_VARIANT;
+
+#if defined(BENCH_IP8)
+
+#if defined(BENCH_IP_GPIOR)
+#define bench_ip GPIOR0
+const uint8_t bench_ip_ram = 0;
+#else
+vthread_ip8_t bench_ip;
+const uint8_t bench_ip_ram = sizeof(bench_ip);
+#endif
+
+#define WL_INIT(thread, ip)             VT_INIT8(thread, ip)
+#define WL_BEGIN(thread, ip)            VT_BEGIN8(thread, ip)
+#define WL_YIELD(thread, ip, n)         VT_YIELD8(thread, ip)
+
+#elif defined(BENCH_IP24)
+
+vthread_ip24_t bench_ip;
+const uint8_t bench_ip_ram = sizeof(bench_ip);
+
+#define WL_INIT(thread, ip)             VT_INIT24(thread, ip)
+#define WL_BEGIN(thread, ip)            VT_BEGIN24(thread, ip)
+#define WL_YIELD(thread, ip, n)         VT_YIELD24(thread, ip)
+
+#else
+
+#if defined(BENCH_IP_Z)
+VT_IP_Z(bench_ip);
+const uint8_t bench_ip_ram = 0;
+#define WL_BEGIN(thread, ip)            VT_BEGIN_Z(thread, ip)
+#elif defined(BENCH_IP_REG)
+register vthread_ip_t bench_ip __asm__(BENCH_IP_REG);
+const uint8_t bench_ip_ram = 0;
+#elif defined(BENCH_IP_GPIOR)
+#define bench_ip (*(vthread_ip_t volatile *)&GPIOR1)
+const uint8_t bench_ip_ram = 0;
+#else
+vthread_ip_t bench_ip;
+const uint8_t bench_ip_ram = sizeof(bench_ip);
+#endif
+
+#ifndef WL_BEGIN
+#define WL_BEGIN(thread, ip)            VT_BEGIN(thread, ip)
+#endif
+#define WL_INIT(thread, ip)             VT_INIT(thread, ip)
+#define WL_YIELD(thread, ip, n)         VT_YIELD(thread, ip)
+
+#endif
+
+#define WL_END(thread)                  VT_END(thread)
+
+
+void bench_init(void) {
+  WL_INIT(bench, bench_ip);
+}
+
+#include "workload.h"
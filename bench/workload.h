@@ -0,0 +1,20 @@
+/*
+ * The thread body shared by all variants:
+ * BENCH_YIELDS segments between WL_BEGIN(thread, ip) and WL_END(thread).
+ * The variant defines WL_BEGIN, WL_YIELD(thread, ip, n) and WL_END,
+ * where n is the sequence number of the yield point (1..BENCH_YIELDS).
+ */
+void bench_thread(void) {
+  WL_BEGIN(bench, bench_ip);
+  BENCH_SEGMENT(WL_YIELD(bench, bench_ip, 1));
+  BENCH_SEGMENT(WL_YIELD(bench, bench_ip, 2));
+  BENCH_SEGMENT(WL_YIELD(bench, bench_ip, 3));
+  BENCH_SEGMENT(WL_YIELD(bench, bench_ip, 4));
+#if BENCH_YIELDS > 4
+  BENCH_SEGMENT(WL_YIELD(bench, bench_ip, 5));
+  BENCH_SEGMENT(WL_YIELD(bench, bench_ip, 6));
+  BENCH_SEGMENT(WL_YIELD(bench, bench_ip, 7));
+  BENCH_SEGMENT(WL_YIELD(bench, bench_ip, 8));
+#endif
+  WL_END(bench);
+}
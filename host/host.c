@@ -0,0 +1,184 @@
+/*
+ * Host test of the C library: a pipeline of threads of the ready-mask scheduler.
+ *
+ * The producer takes a block from a pool, sends its index over a channel and delays for a few ticks;
+ * the consumer copies the value into a ring, frees the block and signals a semaphore;
+ * the checker takes the values from the ring, and finally signals an event to the finisher.
+ * A separate thread checks the core macros: yields, marks and seeking.
+ * The aggregator joins a worker that keeps arriving at the barrier after the join.
+ */
+#include <stdint.h>
+#include "vthreads_timer.h"
+#include "vthreads_sync.h"
+#include "vthreads_channel.h"
+#include "vthreads_ring.h"
+#include "vthreads_pool.h"
+#include "host.h"
+
+#define HOST_VALUES 10
+#define HOST_DELAY  3
+
+int host_failed;
+
+VT_THREAD_ID(producer, 0);
+VT_THREAD_ID(consumer, 1);
+VT_THREAD_ID(checker, 2);
+VT_THREAD_ID(finisher, 3);
+VT_THREAD_ID(stepper, 4);
+VT_THREAD_ID(worker, 5);
+VT_THREAD_ID(aggregator, 6);
+
+vthread_ip_t producer_ip, consumer_ip, checker_ip, finisher_ip, stepper_ip, worker_ip, aggregator_ip;
+
+VT_POOL(2, 4) blocks;
+VT_CHANNEL(uint8_t) frames;
+VT_RING(4) values;
+vthread_sem_t received;
+volatile uint8_t done;
+vthread_barrier_t group;
+
+static uint8_t produced, checked, finished;
+static uint8_t steps;
+static uint8_t arrivals, joins, woken;
+
+
+void producer(void) {
+  static uint8_t block;
+  VT_BEGIN(producer, producer_ip);
+  if (produced == HOST_VALUES) VT_WAIT_EVENT(producer, producer_ip, VT_ID(producer));
+  VT_WAIT_ALLOC(producer, producer_ip, blocks, block);
+  VT_POOL_BLOCK(blocks, block)[1] = produced++;
+  VT_SEND(producer, producer_ip, frames, block);
+  VT_DELAY(producer, producer_ip, HOST_DELAY);
+  VT_END(producer);
+}
+
+void consumer(void) {
+  static uint8_t block;
+  VT_BEGIN(consumer, consumer_ip);
+  VT_RECV(consumer, consumer_ip, frames, block);
+  VT_RING_PUT(values, VT_POOL_BLOCK(blocks, block)[1]);
+  VT_POOL_FREE(blocks, block);
+  VT_SEM_SIGNAL(received, VT_ID(checker));
+  VT_END(consumer);
+}
+
+void checker(void) {
+  VT_BEGIN(checker, checker_ip);
+  VT_SEM_WAIT(checker, checker_ip, received);
+  HOST_CHECK(!VT_RING_EMPTY(values));
+  HOST_CHECK(VT_RING_GET(values) == checked);
+  if (++checked == HOST_VALUES) VT_EVENT_SIGNAL(done, VT_ID(finisher));
+  VT_END(checker);
+}
+
+void finisher(void) {
+  VT_BEGIN(finisher, finisher_ip);
+  VT_EVENT_WAIT(finisher, finisher_ip, done);
+  finished = 1;
+  VT_WAIT_EVENT(finisher, finisher_ip, VT_ID(finisher));
+  VT_END(finisher);
+}
+
+void stepper(void) {
+  VT_BEGIN(stepper, stepper_ip);
+  steps += 1;
+  VT_YIELD(stepper, stepper_ip);
+  VT_MARK(stepper, "second");
+  steps += 10;
+  VT_YIELD(stepper, stepper_ip);
+  steps += 100;
+  VT_WAIT_EVENT(stepper, stepper_ip, VT_ID(stepper));
+  VT_END(stepper);
+}
+
+void worker(void) {
+  VT_BEGIN(worker, worker_ip);
+  VT_BARRIER_ARRIVE(group, VT_ID(worker));
+  if (++arrivals == 3) VT_WAIT_EVENT(worker, worker_ip, VT_ID(worker));
+  VT_END(worker);
+}
+
+void aggregator(void) {
+  VT_BEGIN(aggregator, aggregator_ip);
+  VT_READY_SET(VT_ID(worker));
+  VT_WAIT_ALL(aggregator, aggregator_ip, group, (vthread_mask_t)1 << VT_ID(worker));
+  joins++;
+  VT_WAIT_EVENT(aggregator, aggregator_ip, VT_ID(aggregator));
+  woken++;
+  VT_END(aggregator);
+}
+
+VT_SCHEDULER(producer, consumer, checker, finisher, stepper, worker, aggregator);
+VT_TIMER_SERVICE;
+
+
+static void test_core(void) {
+  VT_INIT(stepper, stepper_ip);
+  VT_READY_SET(VT_ID(stepper));
+  vt_run_until_idle();
+  HOST_CHECK(steps == 111);
+  HOST_CHECK(vt_ready_mask() == 0);
+
+  VT_SEEK(stepper, stepper_ip, "second");
+  VT_READY_SET(VT_ID(stepper));
+  vt_run_until_idle();
+  HOST_CHECK(steps == 221);
+}
+
+static void test_pipeline(void) {
+  uint16_t ticks;
+
+  VT_POOL_INIT(blocks);
+  VT_INIT(producer, producer_ip);
+  VT_INIT(consumer, consumer_ip);
+  VT_INIT(checker, checker_ip);
+  VT_INIT(finisher, finisher_ip);
+  VT_READY_SET(VT_ID(producer));
+  VT_READY_SET(VT_ID(consumer));
+  VT_READY_SET(VT_ID(checker));
+  VT_READY_SET(VT_ID(finisher));
+
+  for (ticks = 0; ticks < 1000 && !finished; ticks++) {
+    vt_run_until_idle();
+    vt_timer_tick();
+  }
+  HOST_CHECK(finished);
+  HOST_CHECK(checked == HOST_VALUES);
+  HOST_CHECK(VT_RING_EMPTY(values));
+  HOST_CHECK(VT_SEM_COUNT(received) == 0);
+  HOST_CHECK(ticks >= (HOST_VALUES - 1) * HOST_DELAY && ticks <= HOST_VALUES * HOST_DELAY + 1);
+
+  for (ticks = 0; ticks < HOST_DELAY; ticks++) {
+    vt_timer_tick();
+    vt_run_until_idle();
+  }
+  HOST_CHECK(vt_timer_expired(VT_ID(producer)));
+  HOST_CHECK(vt_ready_mask() == 0);
+
+  HOST_CHECK(VT_POOL_ALLOC(blocks) != VT_POOL_NONE);
+  HOST_CHECK(VT_POOL_ALLOC(blocks) != VT_POOL_NONE);
+  HOST_CHECK(VT_POOL_ALLOC(blocks) == VT_POOL_NONE);
+}
+
+static void test_barrier(void) {
+  vthread_barrier_t fresh = { 0, 0 };
+  VT_BARRIER_ARRIVE(fresh, VT_ID(worker));
+  HOST_CHECK(vt_ready_mask() == 0);
+
+  VT_INIT(worker, worker_ip);
+  VT_INIT(aggregator, aggregator_ip);
+  VT_READY_SET(VT_ID(aggregator));
+  vt_run_until_idle();
+  HOST_CHECK(arrivals == 3);
+  HOST_CHECK(joins == 1);
+  HOST_CHECK(woken == 0);
+  HOST_CHECK(vt_ready_mask() == 0);
+}
+
+int main(void) {
+  test_core();
+  test_pipeline();
+  test_barrier();
+  return HOST_RESULT();
+}
@@ -0,0 +1,66 @@
+/*
+ * Host test of the C++ layer: threads declared as classes, with the instruction pointer in RAM
+ * and behind a register-style reference, dispatched by a thread_list, and moved to typed marks.
+ * A thread with the instruction pointer in memory-mapped registers (io_ip) is only compiled.
+ */
+#include "vthreads.hpp"
+#include "host.h"
+
+int host_failed;
+
+VT_THREAD_ID(counter, 0);
+VT_THREAD_ID(adder, 1);
+
+VT_CXX_THREAD(counter, vthreads::ram_ip<counter>);
+
+vthread_ip_t adder_ip;
+VT_CXX_IP_REGISTER(adder_storage, adder_ip);
+VT_CXX_THREAD(adder, adder_storage);
+
+VT_CXX_MARK(counter, again);
+
+// Compiled only: the memory-mapped registers do not exist on the host, so the thread has no body.
+VT_THREAD_ID(register_thread, 2);
+VT_CXX_THREAD(register_thread, vthreads::io_ip<0x4A>);
+static_assert(vthreads::same<decltype(register_thread::ip()), vthread_ip_t volatile &>::value,
+              "io_ip gives a volatile reference to the instruction pointer");
+
+static int total;
+
+void counter::run() {
+  VT_BEGIN(counter, ip());
+  total += 1;
+  VT_YIELD(counter, ip());
+  VT_MARK(counter, "again");
+  total += 10;
+  VT_WAIT_EVENT(counter, ip(), VT_ID(counter));
+  VT_END(counter);
+}
+
+void adder::run() {
+  VT_BEGIN(adder, ip());
+  total += 100;
+  VT_WAIT_EVENT(adder, ip(), VT_ID(adder));
+  VT_END(adder);
+}
+
+typedef vthreads::thread_list<counter, adder> threads;
+VT_CXX_READY_MASK;
+
+
+int main() {
+  threads::init();
+  VT_READY_SET(VT_ID(counter));
+  VT_READY_SET(VT_ID(adder));
+  for (int i = 0; i < 4; i++) threads::dispatch();
+  HOST_CHECK(total == 111);
+  HOST_CHECK(vt_ready_mask() == 0);
+
+  counter::seek<counter__again>();
+  VT_READY_SET(VT_ID(counter));
+  threads::dispatch();
+  HOST_CHECK(total == 121);
+  HOST_CHECK(vt_ready_mask() == 0);
+
+  return HOST_RESULT();
+}
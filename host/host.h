@@ -0,0 +1,29 @@
+#ifndef __HOST_H__
+#define __HOST_H__
+
+/**
+ * \file
+ * Host regression test harness.
+ *
+ * The tests build the library with the portable backend of vthreads_port.h and run it natively,
+ * so the logic of the threads can be checked without a device or a simulator.
+ * Every failed check prints its location; the test exits with 1 if any check failed.
+ * \author semicontinuity
+ */
+
+#include <stdio.h>
+
+extern int host_failed;
+
+/** Check the condition, and report it if it does not hold. */
+#define HOST_CHECK(condition) do {                                          \
+  if (!(condition)) {                                                       \
+    printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);    \
+    host_failed = 1;                                                        \
+  }                                                                         \
+} while(0)
+
+/** Report the result of the test, and return the exit status. */
+#define HOST_RESULT() (printf("%s\n", host_failed ? "FAILED" : "ok"), host_failed)
+
+#endif
@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Host regression tests.
+#
+# Builds the tests with the portable backend of vthreads_port.h for the machine running the script,
+# at every optimization level, as C and as C++ (host.c is valid C++ too), with all warnings as errors,
+# and runs every build. Stops at the first failure.
+#   host.c    - core macros, scheduler, timer, events and semaphores, channel, ring and pool
+#   host.cpp  - the C++ layer of vthreads.hpp
+#
+# Usage: run.sh
+#
+# Environment: CC (cc), CXX (c++), OPTS (-O0 -O1 -O2 -O3 -Os)
+
+set -e
+
+CC=${CC:-cc}
+CXX=${CXX:-c++}
+OPTS=${OPTS:--O0 -O1 -O2 -O3 -Os}
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+OUT=${OUT:-$HERE/out}
+WARNINGS="-Wall -Wextra -Werror"
+INCLUDES="-I$HERE/../include -I$HERE"
+DEFINES="-DVT_SCHEDULER_WAITS"
+
+mkdir -p "$OUT"
+
+# check <variant> <compiler> [compiler flags...]: build and run one variant
+check() {
+  name=$1; compiler=$2; shift 2
+  $compiler "$@" $WARNINGS $DEFINES $INCLUDES -o "$OUT/$name"
+  printf '%-10s ' "$name"
+  "$OUT/$name"
+}
+
+for opt in $OPTS; do
+  check "c$opt"     "$CC"  -std=gnu99 $opt "$HERE/host.c"
+  check "c++$opt"   "$CXX" -std=c++11 $opt -x c++ "$HERE/host.c"
+  check "layer$opt" "$CXX" -std=c++11 $opt "$HERE/host.cpp"
+done
@@ -9,14 +9,21 @@
  * With some optimizations, provides faster thread switching.
  *
  * Differences to Protothreads:
- *  - Virtual thread functions do not have take 'thread' argument - ususally they can serve only one thread.
+ *  - Virtual thread functions do not have take 'thread' argument - ususally they can serve only one thread
+ *    (multi-instance threads, see VT_BEGIN_INSTANCE, take a pointer to the instance context instead).
  *  - Virtual thread functions must have 'void' return type - thus it is possible to use inside interrupt handlers.
  *  - Virtual thread runs forever over and over - if the thread has finished or waiting, and it is not necessary to schedule
- *    the thread function, it should communicate this to scheduler via some shared variable.
+ *    the thread function, it should communicate this to scheduler via some shared variable
+ *    (vthreads_scheduler.h provides a ready-mask scheduler for this).
  *  - Virtual thread functions do not reference thread's data via pointer - thus it is possible to place it to the registers.
  *  - It is possible to move the instruction pointer of the virtual thread by seeking to the specified mark in the thread function.
  *
  * Supported compiler: avr-gcc, or any other with support for address labels.
+ * On AVR, the addresses of the asm labels (BEGIN, marks) are loaded with ldi pm_lo8/pm_hi8,
+ * or with ldi lo8/hi8 of gs() on devices with more than 128 KB of flash, where the linker
+ * then routes the labels above 128 KB through .trampolines stubs, as it does for C label addresses.
+ * Elsewhere, they are taken as the addresses of extern symbols named after the labels,
+ * so the same thread code runs on the host, ARM Cortex-M or RISC-V (see also vthreads_port.h).
  *
  * Please refer to Protothreads documentation for usage details and concepts behind implementation.
  * \author semicontinuity
@@ -29,23 +36,37 @@
  * For good performance, place it to the general purpose I/O register.
  * For better performance, place it in the register.
  * For best performance, place it in the high register (r16-r24).
- * For utmost performance, place it to r30.
+ * For utmost performance, place it to r30 (see VT_IP_Z and VT_BEGIN_Z).
+ * On devices with more than 128 KB of flash, see vthread_ip24_t to resume without linker trampolines.
  * Beware of compiler bug when placed to the register (except r30).
  */
 typedef void * vthread_ip_t;
 
+#include <stdint.h>
+
 
 #define FC_ASM_LABEL_NAME(thread, mark) #thread "__" mark
 #define FC_ASM_LABEL_BEGIN(thread)      FC_ASM_LABEL_NAME(thread, "BEGIN")
 #define FC_ASM_LABEL_STOP(thread)	FC_ASM_LABEL_NAME(thread, "STOP")
 #define FC_ASM_LABEL(label)             do { __asm__ __volatile__( label ":"); } while(0)
 
+#ifdef __AVR__
+
+#ifdef __AVR_HAVE_EIJMP_EICALL__
+/* A 16-bit word address that reaches every label: a trampoline stub for the labels above 128 KB. */
+#define FC_ASM_LO8(label) "lo8(gs(" label "))"
+#define FC_ASM_HI8(label) "hi8(gs(" label "))"
+#else
+#define FC_ASM_LO8(label) "pm_lo8(" label ")"
+#define FC_ASM_HI8(label) "pm_hi8(" label ")"
+#endif
+
 #define FC_ASM_LABEL_ADDRESS(label)	\
 (__extension__({                        \
   uint16_t __result;                    \
   __asm__ __volatile__ (		\
-    "ldi %A0, pm_lo8(" label ")\n\t"	\
-    "ldi %B0, pm_hi8(" label ")\n\t"	\
+    "ldi %A0, " FC_ASM_LO8(label) "\n\t"	\
+    "ldi %B0, " FC_ASM_HI8(label) "\n\t"	\
         : "=d"(__result)		\
   );					\
   __result;                             \
@@ -53,16 +74,152 @@ typedef void * vthread_ip_t;
 
 #define FC_POINTER(label) ((void*)FC_ASM_LABEL_ADDRESS(label))
 
+#else
+
+/*
+ * On Thumb, code addresses carry the Thumb bit, as the addresses of C labels and functions do.
+ */
+#if defined(__thumb__)
+#define FC_THUMB_BIT 1
+#else
+#define FC_THUMB_BIT 0
+#endif
+
+#define FC_ASM_LABEL_ADDRESS2(label, symbol)                            \
+(__extension__({                                                        \
+  extern const char symbol[] __asm__(label);                            \
+  (uintptr_t)symbol | FC_THUMB_BIT;                                     \
+}))
+
+#define FC_ASM_LABEL_ADDRESS(label) FC_ASM_LABEL_ADDRESS2(label, FC_CONCAT(vt_label_, __COUNTER__))
+
+#define FC_POINTER(label) ((void*)FC_ASM_LABEL_ADDRESS(label))
+
+#endif
+
 
 
 #define FC_RESUME(s)			\
   do {					\
+      goto *(void *)(s);		\
+  } while(0)
+
+/*
+ * Fails the compilation unless the instruction pointer is declared with VT_IP_Z, i.e. is a register variable in r30:r31.
+ * Emits no code.
+ */
+#define FC_CHECK_Z(s) ((void)sizeof(FC_CONCAT2(vt_ip_z__, s)))
+
+#define FC_RESUME_Z(s)                  \
+  do {                                  \
+      FC_CHECK_Z(s);                    \
       goto *s;				\
   } while(0)
 
+/*
+ * The address of a local label.
+ * Passing it through an empty asm keeps -Wdangling-pointer from mistaking the label
+ * for a local variable when the address is stored before a return; generates no code.
+ */
+#define FC_LABEL_ADDRESS(label)         \
+(__extension__({                        \
+  void *__address = &&label;            \
+  __asm__ ("" : "+r"(__address));       \
+  __address;                            \
+}))
+
+/*
+ * Save the continuation and return the value (nothing, for void thread functions);
+ * the thread resumes right after the label.
+ */
+#define FC_SUSPEND_RETURN(s, label, value) \
+  FC_HOOK_SUSPEND                       \
+  (s) = FC_LABEL_ADDRESS(label);        \
+  return value;                         \
+  label:                                \
+  FC_MAP_POINT
+
+#define FC_SUSPEND(s, label) FC_SUSPEND_RETURN(s, label, )
+
+/*
+ * With VT_CLOCK defined, every resume records the time the thread slice started (see VT_YIELD_BUDGET).
+ */
+#ifdef VT_CLOCK
+#ifndef VT_CLOCK_T
+#define VT_CLOCK_T uint16_t
+#endif
+#define FC_SLICE_START VT_CLOCK_T vt_slice __attribute__((unused)) = VT_CLOCK();
+#else
+#define FC_SLICE_START
+#endif
+
+/*
+ * With VT_STATS defined, the resumes, yields and passes of every thread are recorded (see vthreads_stats.h).
+ */
+#ifdef VT_STATS
+#include "vthreads_stats.h"
+#else
+#define FC_STATS_BEGIN(thread)
+#define FC_STATS_SUSPEND
+#define FC_STATS_END
+#define FC_STATS_WAKE(id) do {} while(0)
+#define FC_STATS_WAKE_MASK(mask) do {} while(0)
+#endif
+
+/*
+ * With VT_TRACE defined, the resumes and yields of every thread are logged to a ring (see vthreads_trace.h).
+ */
+#ifdef VT_TRACE
+#include "vthreads_trace.h"
+#else
+#define FC_TRACE_BEGIN(thread)
+#define FC_TRACE_SUSPEND
+#endif
+
+#define FC_HOOK_BEGIN(thread) FC_STATS_BEGIN(thread) FC_TRACE_BEGIN(thread)
+#define FC_HOOK_SUSPEND FC_STATS_SUSPEND FC_TRACE_SUSPEND
+
+/*
+ * With VT_MAP defined, every resume point is labelled for tools/vt_map.py:
+ * "vt__yield_<line>_<n>" where the thread always suspends when the code falls into the label (or never falls into it),
+ * "vt__wait_<line>_<n>" where it proceeds if the condition of the wait is already true.
+ * The labels are local symbols and generate no instructions; %= keeps them unique when the compiler duplicates code.
+ */
+#ifdef VT_MAP
+#define FC_MAP_POINT __asm__ __volatile__ ("vt__yield_" FC_STRINGIFY(__LINE__) "_%=:" ::);
+#define FC_MAP_WAIT __asm__ __volatile__ ("vt__wait_" FC_STRINGIFY(__LINE__) "_%=:" ::);
+#else
+#define FC_MAP_POINT
+#define FC_MAP_WAIT
+#endif
+
+/*
+ * With VT_WATCHDOG defined, every mark records its line for the overrun report (see vthreads_watchdog.h).
+ */
+#ifdef VT_WATCHDOG
+extern volatile uint16_t vt_watchdog_line;
+#define FC_WATCHDOG_MARK vt_watchdog_line = __LINE__;
+#else
+#define FC_WATCHDOG_MARK
+#endif
+
+/*
+ * Open the endless loop of the thread body, starting at the BEGIN label.
+ * The address of the C label is taken, so that the compiler treats the loop start
+ * as a target of the resume jump and keeps it (with the BEGIN label) even if
+ * the end of the loop is never reached, e.g. in a thread that finishes with VT_EXIT.
+ */
+#define FC_LOOP_BEGIN(thread)           \
+  for (;;) {                            \
+      vt_begin: (void)&&vt_begin;       \
+      FC_ASM_LABEL(FC_ASM_LABEL_BEGIN(thread));
+
 #define FC_CONCAT2(s1, s2) s1##s2
 #define FC_CONCAT(s1, s2) FC_CONCAT2(s1, s2)
 
+#define FC_STRINGIFY2(s) #s
+#define FC_STRINGIFY(s) FC_STRINGIFY2(s)
+
 
 
 /**
@@ -90,9 +247,37 @@ typedef void * vthread_ip_t;
  */
 #define VT_BEGIN(thread, ip) do {               \
   char vt_flag = 1;                             \
+  FC_SLICE_START                                \
+  FC_HOOK_BEGIN(thread)                         \
   FC_RESUME(ip);                                \
-  for (;;) {                                    \
-      FC_ASM_LABEL(FC_ASM_LABEL_BEGIN(thread));
+  FC_LOOP_BEGIN(thread)
+
+
+/**
+ * Declare the instruction pointer of the virtual thread, pinned to the Z register (r30:r31).
+ * Must be used at file scope, in place of the ordinary vthread_ip_t variable.
+ * All compilation units of the program must be compiled with -ffixed-r30 -ffixed-r31,
+ * so that neither the compiler nor other code clobbers the instruction pointer.
+ * The code that sees the declaration cannot use lpm-based flash reads or indirect calls,
+ * because they need the Z register.
+ * \param ip      An instruction pointer of the virtual thread
+ */
+#define VT_IP_Z(ip) register vthread_ip_t ip __asm__("r30"); typedef char FC_CONCAT2(vt_ip_z__, ip)
+
+
+/**
+ * Declare the start of a virtual thread whose instruction pointer is declared with VT_IP_Z.
+ * The resume is a single ijmp: the instruction pointer is already in Z, so no register moves are needed.
+ * The compilation fails if the instruction pointer is not declared with VT_IP_Z.
+ * \param thread A virtual thread variable
+ * \param ip      An instruction pointer of the virtual thread, declared with VT_IP_Z
+ */
+#define VT_BEGIN_Z(thread, ip) do {             \
+  char vt_flag = 1;                             \
+  FC_SLICE_START                                \
+  FC_HOOK_BEGIN(thread)                         \
+  FC_RESUME_Z(ip);                              \
+  FC_LOOP_BEGIN(thread)
 
 
 /**
@@ -100,6 +285,7 @@ typedef void * vthread_ip_t;
  * \param thread A virtual thread name
  */
 #define VT_END(thread)                          \
+  FC_STATS_END                                  \
   }                                             \
   FC_ASM_LABEL(FC_ASM_LABEL_STOP(thread));      \
   (void)vt_flag;                                \
@@ -118,20 +304,191 @@ typedef void * vthread_ip_t;
 do {                                            \
   vt_flag = 0;				        \
   FC_CONCAT(FC_LABEL, __LINE__):                \
+  FC_MAP_POINT                                  \
   if(vt_flag == 0) {                            \
-    (ip) = &&FC_CONCAT(FC_LABEL, __LINE__);	\
+    FC_HOOK_SUSPEND                             \
+    (ip) = FC_LABEL_ADDRESS(FC_CONCAT(FC_LABEL, __LINE__)); \
+    return;                                     \
+  }                                             \
+} while(0)
+
+
+/**
+ * Yield control from the current virtual thread without the resume flag.
+ * The continuation is the label placed right after the return, so the resumed thread
+ * proceeds to the following operator directly: no store, compare or branch on yield or resume.
+ * A thread that uses only this form of yield does not need the vt_flag local declared by VT_BEGIN,
+ * and the compiler drops it.
+ * Once the virtual thread function is called again, it will resume from the following operator.
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ */
+#define VT_YIELD_DIRECT(thread, ip)             \
+do {                                            \
+  FC_SUSPEND(ip, FC_CONCAT(FC_LABEL, __LINE__)); \
+} while(0)
+
+
+/**
+ * Yield control from the current virtual thread until the condition is true.
+ * The condition is checked every time the virtual thread function is called;
+ * once it is true, the thread proceeds to the following operator.
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ * \param cond    The condition to wait for
+ */
+#define VT_WAIT_UNTIL(thread, ip, cond)         \
+do {                                            \
+  FC_CONCAT(FC_LABEL, __LINE__):                \
+  FC_MAP_WAIT                                   \
+  if (!(cond)) {                                \
+    FC_HOOK_SUSPEND                             \
+    (ip) = FC_LABEL_ADDRESS(FC_CONCAT(FC_LABEL, __LINE__)); \
     return;                                     \
   }                                             \
 } while(0)
 
 
+/**
+ * Yield control from the current virtual thread only if the condition is true.
+ * Useful to keep processing queued work while nothing else needs the CPU.
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ * \param cond    The condition to yield on
+ */
+#define VT_YIELD_IF(thread, ip, cond)           \
+do {                                            \
+  if (cond) {                                   \
+    FC_SUSPEND(ip, FC_CONCAT(FC_LABEL, __LINE__)); \
+  }                                             \
+} while(0)
+
+
+#ifdef VT_CLOCK
+/**
+ * Yield control from the current virtual thread only if it has run for at least the given time
+ * since it was resumed, so that a batch of work is processed per dispatch.
+ * Requires VT_CLOCK: define it, before including this file, to read a free-running timer (e.g. TCNT1),
+ * and VT_CLOCK_T to its type, if it is not uint16_t.
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ * \param ticks   The time slice of the thread, in VT_CLOCK ticks (CPU cycles when the timer runs at clk/1)
+ */
+#define VT_YIELD_BUDGET(thread, ip, ticks)      \
+  VT_YIELD_IF(thread, ip, (VT_CLOCK_T)(VT_CLOCK() - vt_slice) >= (VT_CLOCK_T)(ticks))
+#endif
+
+
+/**
+ * Finish the virtual thread: clear its instruction pointer and return.
+ * This is how a child virtual thread reports completion to VT_SPAWN or VT_JOIN.
+ * The thread must be initialized again before it is called next time.
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ */
+#define VT_EXIT(thread, ip) do { FC_HOOK_SUSPEND (ip) = 0; return; } while(0)
+
+/**
+ * Check whether the virtual thread has finished with VT_EXIT.
+ * \param ip      An instruction pointer of the virtual thread
+ */
+#define VT_FINISHED(ip) ((ip) == 0)
+
+
+/**
+ * Run a child virtual thread until it finishes with VT_EXIT.
+ * The child is initialized and called right away. While it has not finished, the parent yields,
+ * with its continuation set right at the call of the child: every next call of the parent
+ * resumes the child directly, without re-running any code of the parent.
+ * The child has its own instruction pointer, so its code can be shared by several parents,
+ * provided that they do not run it concurrently (or use a multi-instance child with a context per parent).
+ * \param thread   A virtual thread name
+ * \param ip       An instruction pointer of the virtual thread
+ * \param child    A name of the child virtual thread
+ * \param child_ip An instruction pointer of the child virtual thread
+ * \param call     The call of the child thread function
+ */
+#define VT_SPAWN(thread, ip, child, child_ip, call) \
+do {                                            \
+  VT_INIT(child, child_ip);                     \
+  FC_CONCAT(FC_LABEL, __LINE__):                \
+  FC_MAP_WAIT                                   \
+  call;                                         \
+  if (!VT_FINISHED(child_ip)) {                 \
+    FC_HOOK_SUSPEND                             \
+    (ip) = FC_LABEL_ADDRESS(FC_CONCAT(FC_LABEL, __LINE__)); \
+    return;                                     \
+  }                                             \
+} while(0)
+
+
+/**
+ * Yield until the child virtual thread, run by someone else (e.g. the scheduler), finishes with VT_EXIT.
+ * \param thread   A virtual thread name
+ * \param ip       An instruction pointer of the virtual thread
+ * \param child_ip An instruction pointer of the child virtual thread
+ */
+#define VT_JOIN(thread, ip, child_ip) VT_WAIT_UNTIL(thread, ip, VT_FINISHED(child_ip))
+
+
+/*
+ * Generators.
+ *
+ * A generator is a virtual thread function with a return type (e.g. uint8_t or uint16_t),
+ * that produces one value per call: the consumer pulls the next value with an ordinary call,
+ * and gets it in the return registers (r24, r24:r25), with no global variable in between.
+ * The body is written as usual, between VT_BEGIN and VT_END, yielding with VT_YIELD_VALUE only
+ * (the other yields return no value).
+ *
+ * \code
+ * uint8_t pattern(void) {
+ *   static uint8_t i;
+ *   VT_BEGIN(pattern, pattern_ip);
+ *   for (i = 0; i < 8; i++) VT_YIELD_VALUE(pattern, pattern_ip, 1 << i);
+ *   VT_YIELD_VALUE(pattern, pattern_ip, 0xFF);
+ *   VT_END(pattern);
+ * }
+ *
+ * PORTB = pattern();
+ * \endcode
+ */
+
+/**
+ * Return the value from the generator.
+ * Once the generator function is called again, it will resume from the following operator.
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ * \param value   The value to return
+ */
+#define VT_YIELD_VALUE(thread, ip, value)       \
+do {                                            \
+  FC_SUSPEND_RETURN(ip, FC_CONCAT(FC_LABEL, __LINE__), (value)); \
+} while(0)
+
+/**
+ * Finish the generator with the last value: clear its instruction pointer and return the value.
+ * The generator must be initialized again before it is called next time (see VT_FINISHED).
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ * \param value   The value to return
+ */
+#define VT_EXIT_VALUE(thread, ip, value) do { FC_HOOK_SUSPEND (ip) = 0; return (value); } while(0)
+
+
+#ifdef VT_DIRECT_YIELD
+/* Make every VT_YIELD in the compilation unit take the flag-free path. */
+#undef VT_YIELD
+#define VT_YIELD(thread, ip) VT_YIELD_DIRECT(thread, ip)
+#endif
+
+
 /**
  * Mark the current position in the virtual thread.
  * Later, seek operation can be used to restore this position.
  * \param thread  A virtual thread name
  * \param mark    The name of the mark
  */
-#define VT_MARK(thread, mark) FC_ASM_LABEL(FC_ASM_LABEL_NAME(thread, mark))
+#define VT_MARK(thread, mark) do { FC_ASM_LABEL(FC_ASM_LABEL_NAME(thread, mark)); FC_WATCHDOG_MARK } while(0)
 
 /**
  * Set the current position in the given virtual thread to the specified mark.
@@ -144,4 +501,371 @@ do {                                            \
   ip = FC_POINTER(FC_ASM_LABEL_NAME(thread, mark)); \
 } while(0)
 
+
+/*
+ * Multi-instance virtual threads.
+ *
+ * One thread function serves several identical virtual threads (e.g. channels of a protocol).
+ * Every instance has a context structure that starts with VT_INSTANCE_IP,
+ * and the function receives a pointer to the context of the instance to run.
+ * Since all fields are accessed through that pointer, the compiler keeps it in Y or Z
+ * and reaches the fields with displacement addressing (ldd/std).
+ * The asm labels of the thread (BEGIN, STOP, marks) are shared by all instances.
+ *
+ * \code
+ * struct channel { VT_INSTANCE_IP; uint8_t count; };
+ * struct channel channels[8];
+ *
+ * void channel_thread(struct channel *self) {
+ *   VT_BEGIN_INSTANCE(channel, self);
+ *   ...
+ *   VT_YIELD_INSTANCE(channel, self);
+ *   VT_END(channel);
+ * }
+ * \endcode
+ */
+
+/**
+ * Declare the instruction pointer of the instance, as the first member of the instance context structure.
+ */
+#define VT_INSTANCE_IP vthread_ip_t vt_ip
+
+/**
+ * Initialize the given instance of the virtual thread.
+ * \param thread    A name of the virtual thread
+ * \param instances An array of instance contexts
+ * \param i         The index of the instance
+ */
+#define VT_INIT_INSTANCE(thread, instances, i) VT_INIT(thread, (instances)[i].vt_ip)
+
+/**
+ * Restart the given instance of the virtual thread.
+ * \param thread    A name of the virtual thread
+ * \param instances An array of instance contexts
+ * \param i         The index of the instance
+ */
+#define VT_RESTART_INSTANCE(thread, instances, i) VT_RESTART(thread, (instances)[i].vt_ip)
+
+/**
+ * Set the current position in the given instance of the virtual thread to the specified mark.
+ * \param thread    A virtual thread name
+ * \param instances An array of instance contexts
+ * \param i         The index of the instance
+ * \param mark      The name of the mark
+ */
+#define VT_SEEK_INSTANCE(thread, instances, i, mark) VT_SEEK(thread, (instances)[i].vt_ip, mark)
+
+/**
+ * Declare the start of a multi-instance virtual thread.
+ * \param thread  A virtual thread name
+ * \param self    A pointer to the context of the instance being run
+ */
+#define VT_BEGIN_INSTANCE(thread, self) VT_BEGIN(thread, (self)->vt_ip)
+
+/**
+ * Yield control from the current instance of the virtual thread.
+ * \param thread  A virtual thread name
+ * \param self    A pointer to the context of the instance being run
+ */
+#define VT_YIELD_INSTANCE(thread, self) VT_YIELD(thread, (self)->vt_ip)
+
+/*
+ * Compact instruction pointers.
+ *
+ * The continuation is kept as an index into the per-thread jump table in flash.
+ * The table is assembled from the thread's yield points and marks themselves:
+ * each of them appends its address to the section of the thread, and takes the next index
+ * from the counter symbol "thread__COUNT", so no separate build step is needed.
+ */
+
+/**
+ * A compact virtual thread instruction pointer type.
+ * Stores the index of the continuation in the jump table of the thread (up to 256 entries).
+ * Takes one byte instead of two, at the cost of one table lookup on resume.
+ * Threads with up to 16 continuations can share a byte (e.g. a GPIOR) as 4-bit bit fields.
+ */
+typedef uint8_t vthread_ip8_t;
+
+#define FC_TABLE_SECTION(thread)        ".progmem.vthreads." #thread
+#define FC_ASM_LABEL_TABLE(thread)      FC_ASM_LABEL_NAME(thread, "TABLE")
+#define FC_ASM_LABEL_COUNT(thread)      FC_ASM_LABEL_NAME(thread, "COUNT")
+#define FC_ASM_LABEL_INDEX(thread, mark) FC_ASM_LABEL_NAME(thread, mark "__INDEX")
+
+/*
+ * Start the jump table of the thread, with the entry 0 pointing to the BEGIN label.
+ */
+#define FC_TABLE_BEGIN(thread)                                  \
+  __asm__ __volatile__ (                                        \
+    ".pushsection " FC_TABLE_SECTION(thread) ",\"a\",@progbits\n\t" \
+    FC_ASM_LABEL_TABLE(thread) ":\n\t"                          \
+    ".word gs(" FC_ASM_LABEL_BEGIN(thread) ")\n\t"              \
+    ".popsection\n\t"                                           \
+    ".set " FC_ASM_LABEL_COUNT(thread) ", 1\n\t"                \
+  )
+
+/*
+ * Look up the continuation of the thread in its jump table and jump to it.
+ */
+#define FC_RESUME8(thread, s)                                   \
+  do {                                                          \
+      void *__target;                                           \
+      __asm__ __volatile__ (                                    \
+        "ldi r30, lo8(" FC_ASM_LABEL_TABLE(thread) ")\n\t"      \
+        "ldi r31, hi8(" FC_ASM_LABEL_TABLE(thread) ")\n\t"      \
+        "add r30, %1\n\t"                                       \
+        "adc r31, __zero_reg__\n\t"                             \
+        "add r30, %1\n\t"                                       \
+        "adc r31, __zero_reg__\n\t"                             \
+        "lpm __tmp_reg__, Z+\n\t"                               \
+        "lpm r31, Z\n\t"                                        \
+        "mov r30, __tmp_reg__\n\t"                              \
+            : "=&z"(__target)                                   \
+            : "r"((uint8_t)(s))                                 \
+      );                                                        \
+      goto *__target;                                           \
+  } while(0)
+
+
+/**
+ * Initialize the virtual thread with a compact instruction pointer.
+ * \param thread  A name of the virtual thread
+ * \param ip      A compact instruction pointer of the virtual thread
+ */
+#define VT_INIT8(thread, ip) do { ip = 0; } while(0)
+
+
+/**
+ * Declare the start of a virtual thread with a compact instruction pointer.
+ * Must be the first statement of the thread function.
+ * \param thread A virtual thread variable
+ * \param ip      A compact instruction pointer of the virtual thread
+ */
+#define VT_BEGIN8(thread, ip) do {              \
+  char vt_flag = 1;                             \
+  FC_SLICE_START                                \
+  FC_HOOK_BEGIN(thread)                         \
+  FC_TABLE_BEGIN(thread);                       \
+  FC_RESUME8(thread, ip);                       \
+  FC_LOOP_BEGIN(thread)
+
+
+/**
+ * Yield control from the current virtual thread with a compact instruction pointer.
+ * Once the virtual thread function is called again, it will resume from the following operator.
+ * \param thread  A virtual thread name
+ * \param ip      A compact instruction pointer of the virtual thread
+ */
+#define VT_YIELD8(thread, ip)                                   \
+do {                                                            \
+  uint8_t __index;                                              \
+  __asm__ __volatile__ (                                        \
+    ".pushsection " FC_TABLE_SECTION(thread) "\n\t"             \
+    ".word %1\n\t"                                              \
+    ".popsection\n\t"                                           \
+    "ldi %0, " FC_ASM_LABEL_COUNT(thread) "\n\t"                \
+    ".set " FC_ASM_LABEL_COUNT(thread) ", " FC_ASM_LABEL_COUNT(thread) " + 1\n\t" \
+        : "=d"(__index)                                         \
+        : "i"(&&FC_CONCAT(FC_LABEL, __LINE__))                  \
+  );                                                            \
+  FC_HOOK_SUSPEND                                               \
+  (ip) = __index;                                               \
+  return;                                                       \
+  FC_CONCAT(FC_LABEL, __LINE__):;                               \
+  FC_MAP_POINT                                                  \
+} while(0)
+
+
+/**
+ * Mark the current position in the virtual thread with a compact instruction pointer.
+ * Later, VT_SEEK8 can be used to restore this position.
+ * \param thread  A virtual thread name
+ * \param mark    The name of the mark
+ */
+#define VT_MARK8(thread, mark) do {                             \
+  __asm__ __volatile__ (                                        \
+    ".pushsection " FC_TABLE_SECTION(thread) "\n\t"             \
+    ".word gs(" FC_ASM_LABEL_NAME(thread, mark) ")\n\t"         \
+    ".popsection\n\t"                                           \
+    ".set " FC_ASM_LABEL_INDEX(thread, mark) ", " FC_ASM_LABEL_COUNT(thread) "\n\t" \
+    ".set " FC_ASM_LABEL_COUNT(thread) ", " FC_ASM_LABEL_COUNT(thread) " + 1\n\t" \
+    FC_ASM_LABEL_NAME(thread, mark) ":\n\t"                     \
+  );                                                            \
+  FC_WATCHDOG_MARK                                              \
+} while(0)
+
+/**
+ * Set the compact instruction pointer of the given virtual thread to the specified mark.
+ * \param thread  A virtual thread name
+ * \param ip      A compact instruction pointer of the virtual thread
+ * \param mark    The name of the mark
+ */
+#define VT_SEEK8(thread, ip, mark) do {                         \
+  uint8_t __index;                                              \
+  __asm__ __volatile__ (                                        \
+    "ldi %0, " FC_ASM_LABEL_INDEX(thread, mark) "\n\t"          \
+        : "=d"(__index)                                         \
+  );                                                            \
+  (ip) = __index;                                               \
+} while(0)
+
+
+#ifdef __AVR_HAVE_EIJMP_EICALL__
+/*
+ * Far instruction pointers, for devices with more than 128 KB of flash (EIND register, eijmp).
+ *
+ * An ordinary instruction pointer holds a 16-bit word address, so the linker routes continuations
+ * above 128 KB (both C labels and, through gs(), the asm labels of VT_INIT and VT_SEEK)
+ * through .trampolines stubs, which adds a jump to every resume.
+ * A far instruction pointer holds the full 3-byte word address of the continuation,
+ * and the thread resumes with eijmp right into it, wherever the thread code is placed.
+ * The yields store the address with sts, so the instruction pointer must be a variable with static storage.
+ * EIND is restored to VT_EIND_DEFAULT right after every resume, since the compiled code expects it to stay unchanged;
+ * interrupt handlers do not save it either, so interrupts are disabled from the load of EIND until it is restored.
+ * The state of the I flag is carried across the jump in vt_sreg, a local of the thread function.
+ */
+#include <avr/io.h>
+
+#ifndef VT_EIND_DEFAULT
+/**
+ * The value of EIND that the rest of the program expects (set by the startup code; 0 unless the vectors are moved).
+ */
+#define VT_EIND_DEFAULT 0
+#endif
+
+/**
+ * A far virtual thread instruction pointer type: the 3-byte word address of the continuation.
+ */
+typedef __uint24 vthread_ip24_t;
+
+#define FC_ASM_LABEL_ADDRESS24(label)   \
+(__extension__({                        \
+  vthread_ip24_t __result;              \
+  __asm__ __volatile__ (		\
+    "ldi %A0, pm_lo8(" label ")\n\t"	\
+    "ldi %B0, pm_hi8(" label ")\n\t"	\
+    "ldi %C0, pm_hh8(" label ")\n\t"	\
+        : "=d"(__result)		\
+  );					\
+  __result;                             \
+}))
+
+/*
+ * Jump to the continuation with eijmp, with interrupts disabled and the previous SREG saved in vt_sreg.
+ * The asm never falls through; the computed goto that follows it is the anchor
+ * that makes the compiler treat every address-taken label of the thread as a possible target
+ * (and keep vt_sreg valid at all of them).
+ */
+#define FC_RESUME24(s)                                          \
+  do {                                                          \
+      void *__anchor;                                           \
+      __asm__ __volatile__ (                                    \
+        "in %[sreg], __SREG__\n\t"                              \
+        "cli\n\t"                                               \
+        "out %[eind], %C[ip]\n\t"                               \
+        "movw r30, %A[ip]\n\t"                                  \
+        "eijmp\n\t"                                             \
+            : "=z"(__anchor), [sreg] "=&r"(vt_sreg)             \
+            : [ip] "r"((vthread_ip24_t)(s)),                    \
+              [eind] "I"(_SFR_IO_ADDR(EIND))                    \
+      );                                                        \
+      goto *__anchor;                                           \
+  } while(0)
+
+/*
+ * Restore EIND at a resume point, then enable interrupts if they were enabled before the resume.
+ * vt_sreg is cleared, so that the code, when reached in the ordinary flow (e.g. at a mark), does not enable them.
+ */
+#if VT_EIND_DEFAULT == 0
+#define FC_EIND_RESTORE                                         \
+  __asm__ __volatile__ (                                        \
+    "out %[eind], __zero_reg__\n\t"                             \
+    "sbrc %[sreg], 7\n\t"                                       \
+    "sei\n\t"                                                   \
+    "clr %[sreg]\n\t"                                           \
+        : [sreg] "+r"(vt_sreg)                                  \
+        : [eind] "I"(_SFR_IO_ADDR(EIND))                        \
+  )
+#else
+#define FC_EIND_RESTORE                                         \
+  __asm__ __volatile__ (                                        \
+    "out %[eind], %[value]\n\t"                                 \
+    "sbrc %[sreg], 7\n\t"                                       \
+    "sei\n\t"                                                   \
+    "clr %[sreg]\n\t"                                           \
+        : [sreg] "+r"(vt_sreg)                                  \
+        : [eind] "I"(_SFR_IO_ADDR(EIND)), [value] "r"((uint8_t)VT_EIND_DEFAULT) \
+  )
+#endif
+
+
+/**
+ * Initialize the virtual thread with a far instruction pointer.
+ * \param thread  A name of the virtual thread
+ * \param ip      A far instruction pointer of the virtual thread
+ */
+#define VT_INIT24(thread, ip) do { ip = FC_ASM_LABEL_ADDRESS24(FC_ASM_LABEL_BEGIN(thread)); } while(0)
+
+
+/**
+ * Declare the start of a virtual thread with a far instruction pointer.
+ * \param thread A virtual thread variable
+ * \param ip      A far instruction pointer of the virtual thread
+ */
+#define VT_BEGIN24(thread, ip) do {             \
+  char vt_flag = 1;                             \
+  uint8_t vt_sreg;                              \
+  FC_SLICE_START                                \
+  FC_HOOK_BEGIN(thread)                         \
+  FC_RESUME24(ip);                              \
+  FC_LOOP_BEGIN(thread)                         \
+  FC_EIND_RESTORE;
+
+
+/**
+ * Yield control from the current virtual thread with a far instruction pointer.
+ * Once the virtual thread function is called again, it will resume from the following operator.
+ * \param thread  A virtual thread name
+ * \param ip      A far instruction pointer of the virtual thread (a variable with static storage)
+ */
+#define VT_YIELD24(thread, ip)                                  \
+do {                                                            \
+  FC_HOOK_SUSPEND                                               \
+  __asm__ goto (                                                \
+    "ldi r24, pm_lo8(%l1)\n\t"                                  \
+    "sts %0, r24\n\t"                                           \
+    "ldi r24, pm_hi8(%l1)\n\t"                                  \
+    "sts %0+1, r24\n\t"                                         \
+    "ldi r24, pm_hh8(%l1)\n\t"                                  \
+    "sts %0+2, r24\n\t"                                         \
+        : : "i"(&(ip)) : "r24", "memory"                        \
+        : FC_CONCAT(FC_LABEL, __LINE__)                         \
+  );                                                            \
+  return;                                                       \
+  FC_CONCAT(FC_LABEL, __LINE__):                                \
+  FC_MAP_POINT                                                  \
+  (void)&&FC_CONCAT(FC_LABEL, __LINE__);                        \
+  FC_EIND_RESTORE;                                              \
+} while(0)
+
+
+/**
+ * Mark the current position in the virtual thread with a far instruction pointer.
+ * Later, VT_SEEK24 can be used to restore this position.
+ * \param thread  A virtual thread name
+ * \param mark    The name of the mark
+ */
+#define VT_MARK24(thread, mark) do { VT_MARK(thread, mark); FC_EIND_RESTORE; } while(0)
+
+/**
+ * Set the far instruction pointer of the given virtual thread to the specified mark.
+ * \param thread  A virtual thread name
+ * \param ip      A far instruction pointer of the virtual thread
+ * \param mark    The name of the mark
+ */
+#define VT_SEEK24(thread, ip, mark) do {                        \
+  ip = FC_ASM_LABEL_ADDRESS24(FC_ASM_LABEL_NAME(thread, mark)); \
+} while(0)
+
+#endif
+
 #endif
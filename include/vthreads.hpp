@@ -0,0 +1,202 @@
+#ifndef __VTHREADS_HPP__
+#define __VTHREADS_HPP__
+
+/**
+ * \file
+ * C++ layer over vthreads.h and vthreads_scheduler.h, for avr-g++ (C++11 or later).
+ *
+ * A virtual thread is a class declared with VT_CXX_THREAD; the storage of its instruction pointer
+ * is a template parameter (ram_ip, io_ip, or a register declared with VT_CXX_IP_REGISTER).
+ * The thread body is the static member function run(), written with the ordinary macros,
+ * which take ip() as the instruction pointer.
+ *
+ * The dispatcher is generated from the list of thread classes at compile time:
+ * every ready bit is tested against a constant, and the thread is called directly, not through the table
+ * of function pointers. (Thread functions themselves are never inlined, since they contain a computed goto.)
+ *
+ * Marks are types, declared with VT_CXX_MARK, so seek<Mark>() cannot move a thread to a mark of another thread.
+ *
+ * Usage:
+ * \code
+ * VT_THREAD_ID(blink, 0);
+ * VT_CXX_THREAD(blink, vthreads::ram_ip<blink>);
+ * VT_CXX_MARK(blink, off);
+ *
+ * void blink::run() {                     // in exactly one compilation unit
+ *   VT_BEGIN(blink, ip());
+ *   PINB = _BV(PB5);
+ *   VT_YIELD(blink, ip());
+ *   VT_MARK(blink, "off");
+ *   PORTB &= ~_BV(PB5);
+ *   VT_WAIT_EVENT(blink, ip(), VT_ID(blink));
+ *   VT_END(blink);
+ * }
+ *
+ * typedef vthreads::thread_list<blink, button> threads;
+ * VT_CXX_READY_MASK;                      // in exactly one compilation unit, unless the mask is in I/O registers
+ *
+ * int main() {
+ *   threads::init();
+ *   for (;;) threads::dispatch();
+ * }
+ * ...
+ * blink::seek<blink__off>();
+ * \endcode
+ * \author semicontinuity
+ */
+
+#include <stdint.h>
+#include "vthreads_scheduler.h"
+
+
+namespace vthreads {
+
+/**
+ * Instruction pointer storage: a variable in RAM.
+ * \tparam Tag    The thread class
+ */
+template <class Tag>
+struct ram_ip {
+  static vthread_ip_t value;
+  static vthread_ip_t &ip() { return value; }
+};
+
+template <class Tag> vthread_ip_t ram_ip<Tag>::value;
+
+/**
+ * Instruction pointer storage: a pair of memory-mapped registers, e.g. io_ip<0x4A> for GPIOR1:GPIOR2 of the ATmega328P.
+ * The address must be a number: the avr-libc register macros, _SFR_MEM_ADDR included,
+ * expand to pointer casts, which are not constant expressions and cannot be template arguments.
+ * \tparam Address  The data memory address of the low byte
+ */
+template <uint16_t Address>
+struct io_ip {
+  static vthread_ip_t volatile &ip() { return *reinterpret_cast<vthread_ip_t volatile *>(Address); }
+};
+
+
+template <class A, class B> struct same { enum { value = 0 }; };
+template <class A> struct same<A, A> { enum { value = 1 }; };
+
+
+/**
+ * The base of virtual thread classes; see VT_CXX_THREAD.
+ * \tparam Tag        The thread class
+ * \tparam IpStorage  The storage of the instruction pointer
+ */
+template <class Tag, class IpStorage>
+struct vthread {
+  typedef IpStorage storage;
+
+  /** The instruction pointer, as an lvalue for the vthreads.h macros. */
+  static decltype(IpStorage::ip()) ip() { return IpStorage::ip(); }
+
+  /**
+   * Set the instruction pointer to the mark.
+   * \tparam Mark  A mark of this thread, declared with VT_CXX_MARK
+   */
+  template <class Mark>
+  static void seek() {
+    static_assert(same<typename Mark::owner, Tag>::value, "the mark belongs to another virtual thread");
+    ip() = Mark::address();
+  }
+};
+
+
+/**
+ * A list of virtual thread classes, and the dispatcher generated from it.
+ * \tparam Threads  The thread classes
+ */
+template <class... Threads>
+struct thread_list;
+
+template <>
+struct thread_list<> {
+  static void init() {}
+  static void call_all() {}
+  static void dispatch(vthread_mask_t) {}
+};
+
+template <class Thread, class... Rest>
+struct thread_list<Thread, Rest...> {
+  /** Initialize all threads of the list. */
+  static void init() {
+    Thread::init();
+    thread_list<Rest...>::init();
+  }
+
+  /** Call all threads of the list, in order. */
+  static void call_all() {
+    Thread::run();
+    thread_list<Rest...>::call_all();
+  }
+
+  /**
+   * Make one scheduling pass, as vt_dispatch does:
+   * call every thread that is ready at the start of the pass once, in the order of the list.
+   */
+  static void dispatch() { dispatch(vt_ready_mask()); }
+
+  /*
+   * Call the threads of the list whose bits are set in the snapshot of the ready mask.
+   */
+  static void dispatch(vthread_mask_t ready) {
+    if (ready & ((vthread_mask_t)1 << Thread::id)) Thread::run();
+    thread_list<Rest...>::dispatch(ready);
+  }
+};
+
+}
+
+
+/**
+ * Declare a virtual thread class.
+ * The id of the thread must be declared with VT_THREAD_ID before.
+ * The class has the static member functions init() and run() (to be defined by the application),
+ * ip() and seek<Mark>().
+ * \param thread  A virtual thread name
+ * \param ...     The storage of the instruction pointer
+ */
+#define VT_CXX_THREAD(thread, ...)                                      \
+  struct thread : vthreads::vthread<thread, __VA_ARGS__> {              \
+    enum { id = VT_ID(thread) };                                        \
+    static void init() { VT_INIT(thread, ip()); }                       \
+    static void run();                                                  \
+  }
+
+/**
+ * Declare the mark of the virtual thread, as the type thread__mark.
+ * The mark itself is placed in the thread body with VT_MARK(thread, "mark").
+ * \param thread  A virtual thread name
+ * \param mark    The name of the mark
+ */
+#define VT_CXX_MARK(thread, mark)                                       \
+  struct thread##__##mark {                                             \
+    typedef thread owner;                                               \
+    static vthread_ip_t address() { return FC_POINTER(FC_ASM_LABEL_NAME(thread, #mark)); } \
+  }
+
+/**
+ * Declare the instruction pointer storage class that refers to a global register variable
+ * (e.g. one declared with VT_IP_Z).
+ * \param storage The name of the storage class
+ * \param var     The register variable
+ */
+#define VT_CXX_IP_REGISTER(storage, var)                                \
+  struct storage {                                                      \
+    struct reference {                                                  \
+      reference &operator=(vthread_ip_t value) { var = value; return *this; } \
+      operator vthread_ip_t() const { return var; }                     \
+    };                                                                  \
+    static reference ip() { return reference(); }                       \
+  }
+
+/**
+ * Define the ready mask, when it is placed in RAM (the C programs get it from VT_SCHEDULER).
+ * Must be used in exactly one compilation unit.
+ */
+#define VT_CXX_READY_MASK                                               \
+  FC_SCHEDULER_READY_DEFINITION                                         \
+  typedef char vt_ready_mask_defined
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef __VTHREADS_CHANNEL_H__
+#define __VTHREADS_CHANNEL_H__
+
+/**
+ * \file
+ * Rendezvous channels between the virtual threads of the ready-mask scheduler.
+ *
+ * A channel connects one sending and one receiving virtual thread and has no buffer:
+ * VT_SEND completes only after the receiver has taken the value.
+ * Each side records its id in the channel while it waits, so the peer wakes it through its ready bit;
+ * neither side is dispatched while it waits. Both sides run in thread context, so the ready bit is set
+ * with VT_READY_SET, which is atomic against the wakeups posted by interrupt handlers.
+ *
+ * Configuration (define before including this file):
+ *  - VT_CHANNEL_HANDOFF  Define to let VT_SEND transfer control directly to a receiver that waits in VT_RECV:
+ *                        the receiver function is called right away, and when it suspends again,
+ *                        the sender usually proceeds without a round trip through the scheduler.
+ *                        Every stage of a pipeline nests one call deeper, so size the stack for the longest chain.
+ *
+ * Usage:
+ * \code
+ * VT_CHANNEL(int16_t) samples;
+ *
+ * void sampler(void) {
+ *   VT_BEGIN(sampler, sampler_ip);
+ *   VT_DELAY(sampler, sampler_ip, 1);
+ *   VT_SEND(sampler, sampler_ip, samples, adc_read());
+ *   VT_END(sampler);
+ * }
+ *
+ * void filter(void) {
+ *   static int16_t x;
+ *   VT_BEGIN(filter, filter_ip);
+ *   VT_RECV(filter, filter_ip, samples, x);
+ *   accumulate(x);
+ *   VT_END(filter);
+ * }
+ * \endcode
+ * \author semicontinuity
+ */
+
+#include <stdint.h>
+#include "vthreads_scheduler.h"
+
+
+/**
+ * The type of a channel that carries values of the given type.
+ * The 'tx' and 'rx' fields hold the id + 1 of the waiting sender and receiver (0: not waiting).
+ * \param type    The type of the values
+ */
+#define VT_CHANNEL(type)                        \
+  struct {                                      \
+    type value;                                 \
+    volatile uint8_t full;                      \
+    volatile uint8_t tx;                        \
+    volatile uint8_t rx;                        \
+  }
+
+
+#ifdef VT_CHANNEL_HANDOFF
+#define FC_CHANNEL_NOTIFY(id) vt_call(id)
+#else
+#define FC_CHANNEL_NOTIFY(id) VT_READY_SET(id)
+#endif
+
+
+/**
+ * Send the value over the channel and wait until the receiver takes it.
+ * Once the virtual thread function is called again, it will resume from the waiting point.
+ * \param thread  A virtual thread name (with an id declared by VT_THREAD_ID)
+ * \param ip      An instruction pointer of the virtual thread
+ * \param ch      The channel
+ * \param v       The value to send
+ */
+#define VT_SEND(thread, ip, ch, v)              \
+do {                                            \
+  (ch).value = (v);                             \
+  (ch).full = 1;                                \
+  (ch).tx = VT_ID(thread) + 1;                  \
+  if ((ch).rx) FC_CHANNEL_NOTIFY((ch).rx - 1);  \
+  VT_WAIT_EVENT_UNTIL(thread, ip, VT_ID(thread), !(ch).full); \
+} while(0)
+
+/**
+ * Wait until a value is sent over the channel, and take it.
+ * Once the virtual thread function is called again, it will resume from the waiting point.
+ * \param thread  A virtual thread name (with an id declared by VT_THREAD_ID)
+ * \param ip      An instruction pointer of the virtual thread
+ * \param ch      The channel
+ * \param var     The variable that receives the value (must survive yields, e.g. static)
+ */
+#define VT_RECV(thread, ip, ch, var)            \
+do {                                            \
+  (ch).rx = VT_ID(thread) + 1;                  \
+  VT_WAIT_EVENT_UNTIL(thread, ip, VT_ID(thread), (ch).full); \
+  (ch).rx = 0;                                  \
+  (var) = (ch).value;                           \
+  (ch).full = 0;                                \
+  VT_READY_SET((ch).tx - 1);                    \
+  (ch).tx = 0;                                  \
+} while(0)
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef __VTHREADS_ISR_H__
+#define __VTHREADS_ISR_H__
+
+/**
+ * \file
+ * Virtual threads that live in interrupt handlers.
+ *
+ * VT_ISR places the thread body right into the handler.
+ * Since the body is not a separate function, the handler saves only the registers the body uses
+ * (keep the body free of calls to non-inline functions, which would force saving all call-clobbered registers).
+ *
+ * VT_ISR_NAKED generates a handler with no prologue at all, for bodies written in assembly:
+ * the instruction pointer is pinned to Z (see VT_IP_Z), so the handler is a single ijmp into the continuation.
+ * The body saves whatever it touches (including SREG, if it changes flags),
+ * and yields with VT_ASM_YIELD_Z, which loads the next continuation into Z and executes reti.
+ *
+ * VT_ISR_STUB is the same for an instruction pointer kept in memory (RAM, or a pair of GPIORs), when Z cannot be reserved:
+ * the vector stub saves Z, loads the continuation with lds and jumps to it; the body yields with VT_ASM_YIELD_STUB,
+ * which stores the next continuation, restores Z and executes reti.
+ *
+ * Usage:
+ * \code
+ * VT_ISR(TIMER0_COMPA_vect, pwm, pwm_ip)
+ *   PORTB |= _BV(PB1);
+ *   VT_YIELD(pwm, pwm_ip);
+ *   PORTB &= ~_BV(PB1);
+ *   VT_YIELD(pwm, pwm_ip);
+ * VT_ISR_END(pwm)
+ *
+ * VT_IP_Z(bit_ip);
+ * VT_ISR_NAKED(TIMER2_COMPA_vect, bit, bit_ip)
+ *   __asm__ __volatile__ (
+ *     "sbi %[port], 1\n\t"
+ *     VT_ASM_YIELD_Z(bit, "low")
+ *     "cbi %[port], 1\n\t"
+ *     VT_ASM_YIELD_Z(bit, "high")
+ *     :: [port] "I"(_SFR_IO_ADDR(PORTB)));
+ * VT_ISR_NAKED_END(bit)
+ *
+ * vthread_ip_t clock_ip;                  // VT_INIT(clock, clock_ip) at startup
+ * VT_ISR_STUB(TIMER1_COMPA_vect, clock, clock_ip)
+ *   __asm__ __volatile__ (
+ *     "sbi %[port], 2\n\t"
+ *     VT_ASM_YIELD_STUB(clock, "low")
+ *     "cbi %[port], 2\n\t"
+ *     VT_ASM_YIELD_STUB(clock, "high")
+ *     :: [port] "I"(_SFR_IO_ADDR(PORTB)), VT_ASM_IP(clock_ip));
+ * VT_ISR_STUB_END(clock)
+ * \endcode
+ * \author semicontinuity
+ */
+
+#include <avr/interrupt.h>
+#include "vthreads.h"
+
+
+#ifndef VT_ISR_FLAGS
+/**
+ * The attributes of the handlers generated by VT_ISR: ISR_BLOCK (default) or ISR_NOBLOCK.
+ */
+#define VT_ISR_FLAGS ISR_BLOCK
+#endif
+
+
+/**
+ * Declare an interrupt handler that runs the virtual thread, followed by the body of the thread.
+ * Every yield returns from the interrupt; the next interrupt resumes the thread.
+ * \param vector  The interrupt vector
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ */
+#define VT_ISR(vector, thread, ip)              \
+  ISR(vector, VT_ISR_FLAGS) {                   \
+    VT_BEGIN(thread, ip);
+
+/**
+ * Declare the end of the interrupt handler started with VT_ISR.
+ * \param thread  A virtual thread name
+ */
+#define VT_ISR_END(thread)                      \
+    VT_END(thread);                             \
+  }
+
+
+/**
+ * Declare a naked interrupt handler that jumps right into the continuation of the virtual thread,
+ * followed by the body of the thread, in assembly.
+ * \param vector  The interrupt vector
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread, declared with VT_IP_Z
+ */
+#define VT_ISR_NAKED(vector, thread, ip)        \
+  ISR(vector, ISR_NAKED) {                      \
+    FC_CHECK_Z(ip);                             \
+    __asm__ __volatile__ (                      \
+      "ijmp\n\t"                                \
+      FC_ASM_LABEL_BEGIN(thread) ":\n\t"        \
+    );
+
+/**
+ * Declare the end of the naked interrupt handler started with VT_ISR_NAKED.
+ * As with VT_END, the thread then proceeds from the beginning.
+ * \param thread  A virtual thread name
+ */
+#define VT_ISR_NAKED_END(thread)                \
+    __asm__ __volatile__ (                      \
+      "rjmp " FC_ASM_LABEL_BEGIN(thread) "\n\t" \
+      FC_ASM_LABEL_STOP(thread) ":\n\t"         \
+    );                                          \
+  }
+
+
+/**
+ * Assembly text that yields from the naked interrupt handler: loads the continuation into Z
+ * and returns from the interrupt. The next interrupt resumes the thread from the following instruction.
+ * The continuation is the mark "thread__mark", and can also be used with VT_SEEK.
+ * Does not change SREG.
+ * \param thread  A virtual thread name
+ * \param mark    The name of the continuation mark, unique within the thread
+ */
+#define VT_ASM_YIELD_Z(thread, mark)                            \
+  "ldi r30, pm_lo8(" FC_ASM_LABEL_NAME(thread, mark) ")\n\t"    \
+  "ldi r31, pm_hi8(" FC_ASM_LABEL_NAME(thread, mark) ")\n\t"    \
+  "reti\n"                                                      \
+  FC_ASM_LABEL_NAME(thread, mark) ":\n\t"
+
+
+
+/**
+ * Declare a naked interrupt handler that jumps right into the continuation of the virtual thread
+ * kept in memory, followed by the body of the thread, in assembly.
+ * The stub is push, push, lds, lds, ijmp: 10 cycles from the vector to the continuation,
+ * with r30:r31 free for the body. Does not change SREG.
+ * \param vector  The interrupt vector
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread: a variable with static storage, or a pair of GPIORs
+ */
+#define VT_ISR_STUB(vector, thread, ip)         \
+  ISR(vector, ISR_NAKED) {                      \
+    __asm__ __volatile__ (                      \
+      "push r30\n\t"                            \
+      "push r31\n\t"                            \
+      "lds r30, %0\n\t"                         \
+      "lds r31, %0+1\n\t"                       \
+      "ijmp\n\t"                                \
+      FC_ASM_LABEL_BEGIN(thread) ":\n\t"        \
+        : : "i"(&(ip))                          \
+    );
+
+/**
+ * Declare the end of the naked interrupt handler started with VT_ISR_STUB.
+ * As with VT_END, the thread then proceeds from the beginning.
+ * \param thread  A virtual thread name
+ */
+#define VT_ISR_STUB_END(thread) VT_ISR_NAKED_END(thread)
+
+/**
+ * The input operand that the assembly of a VT_ISR_STUB body must pass for VT_ASM_YIELD_STUB.
+ * \param ip      The instruction pointer given to VT_ISR_STUB
+ */
+#define VT_ASM_IP(ip) [vt_ip] "i"(&(ip))
+
+/**
+ * Assembly text that yields from the VT_ISR_STUB handler: stores the continuation, restores Z
+ * and returns from the interrupt. The next interrupt resumes the thread from the following instruction.
+ * The continuation is the mark "thread__mark", and can also be used with VT_SEEK.
+ * Does not change SREG.
+ * \param thread  A virtual thread name
+ * \param mark    The name of the continuation mark, unique within the thread
+ */
+#define VT_ASM_YIELD_STUB(thread, mark)                         \
+  "ldi r30, pm_lo8(" FC_ASM_LABEL_NAME(thread, mark) ")\n\t"    \
+  "ldi r31, pm_hi8(" FC_ASM_LABEL_NAME(thread, mark) ")\n\t"    \
+  "sts %[vt_ip], r30\n\t"                                       \
+  "sts %[vt_ip]+1, r31\n\t"                                     \
+  "pop r31\n\t"                                                 \
+  "pop r30\n\t"                                                 \
+  "reti\n"                                                       \
+  FC_ASM_LABEL_NAME(thread, mark) ":\n\t"
+
+#endif
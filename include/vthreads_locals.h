@@ -0,0 +1,68 @@
+#ifndef __VTHREADS_LOCALS_H__
+#define __VTHREADS_LOCALS_H__
+
+/**
+ * \file
+ * Persistent locals of virtual threads, with overlaid storage.
+ *
+ * Ordinary locals do not survive yields. VT_LOCALS declares the state that does, as one structure per thread,
+ * placed in its own section ".noinit.vthreads.<thread>".
+ * Without further steps, the sections end up in .noinit, each with storage of its own.
+ * The storage of threads that are never active at the same time can be overlaid at link time:
+ * tools/vt_overlay.py generates a linker script fragment that places every group of exclusive threads
+ * at the same address, e.g.
+ *
+ *     tools/vt_overlay.py selftest,run > out/overlay.ld
+ *     avr-gcc ... -Wl,-T,out/overlay.ld
+ *
+ * Mutually exclusive phases of one thread are overlaid at compile time, with a union in the structure.
+ *
+ * The locals are not initialized at startup (since overlaid storage is shared, there is no meaningful initial
+ * state); the thread initializes them itself, e.g. right after VT_BEGIN.
+ *
+ * Usage:
+ * \code
+ * VT_LOCALS(rx,
+ *   uint8_t length;
+ *   union {
+ *     struct { uint8_t count; } header;
+ *     struct { uint8_t index; uint16_t crc; } payload;
+ *   } phase;
+ * );
+ *
+ * void rx_thread(void) {
+ *   VT_BEGIN(rx, rx_ip);
+ *   VT_LOCAL(rx, length) = 0;
+ *   ...
+ *   VT_LOCAL(rx, phase).payload.crc = crc_update(VT_LOCAL(rx, phase).payload.crc, b);
+ *   ...
+ *   VT_END(rx);
+ * }
+ * \endcode
+ * \author semicontinuity
+ */
+
+#include "vthreads.h"
+
+
+#define FC_LOCALS_SECTION(thread)       ".noinit.vthreads." #thread
+#define FC_LOCALS(thread)               FC_CONCAT(thread, __locals)
+
+/**
+ * Declare the persistent locals of the virtual thread.
+ * Must be used at file scope, in the compilation unit of the thread.
+ * \param thread  A virtual thread name
+ * \param ...     The member declarations of the locals structure
+ */
+#define VT_LOCALS(thread, ...)                                          \
+  static struct { __VA_ARGS__ } FC_LOCALS(thread)                       \
+    __attribute__((section(FC_LOCALS_SECTION(thread))))
+
+/**
+ * Access the persistent local of the virtual thread.
+ * \param thread  A virtual thread name
+ * \param name    The name of the local
+ */
+#define VT_LOCAL(thread, name) (FC_LOCALS(thread).name)
+
+#endif
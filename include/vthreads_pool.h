@@ -0,0 +1,145 @@
+#ifndef __VTHREADS_POOL_H__
+#define __VTHREADS_POOL_H__
+
+/**
+ * \file
+ * Fixed-block buffer pool for virtual threads.
+ *
+ * Blocks are referred to by their 8-bit index, so a block is passed along a pipeline of threads
+ * (e.g. through a VT_RING or a VT_CHANNEL) instead of its contents.
+ * The free blocks form a list linked through their first bytes, so allocation and release are O(1)
+ * and take no RAM besides the blocks and the head index.
+ * Allocation and release disable interrupts for a few cycles, and can be used from interrupt handlers.
+ *
+ * With VT_SCHEDULER_WAITS defined, VT_WAIT_ALLOC clears the ready bit of the waiting thread
+ * (its id is declared with VT_THREAD_ID), and VT_POOL_FREE wakes the waiting threads.
+ * Otherwise VT_WAIT_ALLOC polls the pool every time the thread function is called.
+ * The macro must be defined alike in every compilation unit (e.g. on the command line),
+ * or a free in one unit would not wake a thread waiting in another.
+ *
+ * Usage:
+ * \code
+ * VT_POOL(4, 64) frames;
+ *
+ * VT_POOL_INIT(frames);                   // once, at startup
+ *
+ * void rx_thread(void) {
+ *   static uint8_t frame;
+ *   VT_BEGIN(rx, rx_ip);
+ *   VT_WAIT_ALLOC(rx, rx_ip, frames, frame);
+ *   receive(VT_POOL_BLOCK(frames, frame));
+ *   VT_SEND(rx, rx_ip, to_parser, frame);   // the parser calls VT_POOL_FREE(frames, frame) when done
+ *   VT_END(rx);
+ * }
+ * \endcode
+ * \author semicontinuity
+ */
+
+#include <stdint.h>
+#include "vthreads_port.h"
+#include "vthreads.h"
+#ifdef VT_SCHEDULER_WAITS
+#include "vthreads_scheduler.h"
+#elif defined(__VTHREADS_SCHEDULER_H__)
+#error "vthreads_pool.h is used with the scheduler: define VT_SCHEDULER_WAITS in every compilation unit"
+#endif
+
+
+/**
+ * The index that means "no block".
+ */
+#define VT_POOL_NONE 0xFF
+
+/**
+ * The type of a pool of the given number of blocks of the given size.
+ * The 'waiters' field holds the mask of the threads blocked in VT_WAIT_ALLOC.
+ * \param count   The number of blocks, at most 255
+ * \param size    The size of a block in bytes, at least 1
+ */
+#define VT_POOL(count, size)                                            \
+  struct {                                                              \
+    volatile uint8_t free;                                              \
+    volatile uint16_t waiters;                                          \
+    uint8_t data[count][size];                                          \
+    uint8_t size_check[(count) <= 255 && (size) >= 1 ? 0 : -1];         \
+  }
+
+#define FC_POOL_COUNT(pool) ((uint8_t)(sizeof((pool).data) / sizeof((pool).data[0])))
+
+
+/**
+ * Link all blocks of the pool into the free list.
+ * Must be called before the pool is used.
+ */
+#define VT_POOL_INIT(pool) do {                 \
+  uint8_t __i;                                  \
+  for (__i = 0; __i < FC_POOL_COUNT(pool) - 1; __i++) (pool).data[__i][0] = __i + 1; \
+  (pool).data[__i][0] = VT_POOL_NONE;           \
+  (pool).waiters = 0;                           \
+  (pool).free = 0;                              \
+} while(0)
+
+/**
+ * The address of the block with the given index.
+ */
+#define VT_POOL_BLOCK(pool, block) ((pool).data[block])
+
+/**
+ * Take a block from the pool and return its index, or VT_POOL_NONE if all blocks are in use.
+ */
+#define VT_POOL_ALLOC(pool)                     \
+(__extension__({                                \
+  uint8_t __block;                              \
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {           \
+    __block = (pool).free;                      \
+    if (__block != VT_POOL_NONE) (pool).free = (pool).data[__block][0]; \
+  }                                             \
+  __block;                                      \
+}))
+
+
+#ifdef VT_SCHEDULER_WAITS
+#define FC_POOL_WAKE(pool) do { if ((pool).waiters) VT_WAKE_MASK((vthread_mask_t)(pool).waiters); } while(0)
+#else
+#define FC_POOL_WAKE(pool) do {} while(0)
+#endif
+
+/**
+ * Return the block to the pool, and wake the threads waiting for a block.
+ * The wakeup is inside the atomic block, so that it does not race with interrupt handlers
+ * setting other ready bits when the block is freed by a virtual thread.
+ */
+#define VT_POOL_FREE(pool, block) do {          \
+  uint8_t __block = (block);                    \
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {           \
+    (pool).data[__block][0] = (pool).free;      \
+    (pool).free = __block;                      \
+    FC_POOL_WAKE(pool);                         \
+  }                                             \
+} while(0)
+
+
+#ifdef VT_SCHEDULER_WAITS
+#define FC_POOL_WAIT(thread, ip, pool, var)     \
+do {                                            \
+  (pool).waiters |= (uint16_t)1 << VT_ID(thread); \
+  VT_WAIT_EVENT_UNTIL(thread, ip, VT_ID(thread), ((var) = VT_POOL_ALLOC(pool)) != VT_POOL_NONE); \
+  (pool).waiters &= (uint16_t)~((uint16_t)1 << VT_ID(thread)); \
+} while(0)
+#else
+#define FC_POOL_WAIT(thread, ip, pool, var)     \
+  VT_WAIT_UNTIL(thread, ip, ((var) = VT_POOL_ALLOC(pool)) != VT_POOL_NONE)
+#endif
+
+/**
+ * Yield until a block is free, and take it.
+ * The waiters of a pool are virtual threads, which update the waiter mask without disabling interrupts;
+ * interrupt handlers only read it.
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ * \param pool    The pool
+ * \param var     The variable that receives the index of the block (must survive yields, e.g. static)
+ */
+#define VT_WAIT_ALLOC(thread, ip, pool, var) FC_POOL_WAIT(thread, ip, pool, var)
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef __VTHREADS_PORT_H__
+#define __VTHREADS_PORT_H__
+
+/**
+ * \file
+ * Platform layer of the vthreads headers.
+ *
+ * On AVR, includes the avr-libc headers the library is built on.
+ * Elsewhere (host, ARM Cortex-M, RISC-V), provides the few of their definitions the library uses:
+ * flash access (PROGMEM, pgm_read_byte, pgm_read_word), which is ordinary memory access,
+ * and ATOMIC_BLOCK, which masks interrupts on Cortex-M (PRIMASK) and RISC-V (mstatus.MIE)
+ * and does nothing on the host, where only one context is assumed.
+ * The interrupt-specific headers (vthreads_isr.h, vthreads_stack.h, VT_IDLE_SLEEP_MODE) remain AVR-only.
+ * The host build is covered by the regression tests in host/ (see host/run.sh).
+ * \author semicontinuity
+ */
+
+#include <stdint.h>
+
+#ifdef __AVR__
+
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#else
+
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(address))
+
+#if defined(__arm__)
+typedef uint32_t fc_irq_state_t;
+static inline fc_irq_state_t fc_irq_save(void) {
+  fc_irq_state_t state;
+  __asm__ __volatile__ ("mrs %0, primask\n\tcpsid i" : "=r"(state) : : "memory");
+  return state;
+}
+static inline void fc_irq_restore(const fc_irq_state_t *state) {
+  __asm__ __volatile__ ("msr primask, %0" : : "r"(*state) : "memory");
+}
+#elif defined(__riscv)
+typedef unsigned long fc_irq_state_t;
+static inline fc_irq_state_t fc_irq_save(void) {
+  fc_irq_state_t state;
+  __asm__ __volatile__ ("csrrci %0, mstatus, 8" : "=r"(state) : : "memory");
+  return state;
+}
+static inline void fc_irq_restore(const fc_irq_state_t *state) {
+  __asm__ __volatile__ ("csrs mstatus, %0" : : "r"(*state & 8) : "memory");
+}
+#else
+typedef uint8_t fc_irq_state_t;
+static inline fc_irq_state_t fc_irq_save(void) { __asm__ __volatile__ ("" : : : "memory"); return 0; }
+static inline void fc_irq_restore(const fc_irq_state_t *state) { (void)state; __asm__ __volatile__ ("" : : : "memory"); }
+#endif
+
+#ifndef ATOMIC_BLOCK
+/*
+ * The subset of util/atomic.h used by the library: interrupts are masked for the block,
+ * and the previous state is restored when the block is left.
+ */
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_BLOCK(type)                                              \
+  for (fc_irq_state_t __irq_state __attribute__((cleanup(fc_irq_restore))) = fc_irq_save(), \
+       __irq_todo = 1; __irq_todo; __irq_todo = 0)
+#endif
+
+#endif
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef __VTHREADS_RING_H__
+#define __VTHREADS_RING_H__
+
+/**
+ * \file
+ * Single-producer single-consumer ring buffer for virtual threads.
+ *
+ * The producer (typically an interrupt handler) only writes the head index,
+ * the consumer only writes the tail index, so no interrupt disabling is needed.
+ * Indices are free-running bytes; the size must be a power of two, at most 128.
+ *
+ * With VT_SCHEDULER_WAITS defined, VT_WAIT_READ and VT_WAIT_WRITE
+ * clear the ready bit of the waiting thread (its id is declared with VT_THREAD_ID),
+ * so a thread blocked on the buffer is not dispatched until the other side calls VT_WAKE.
+ * Otherwise they poll the buffer every time the thread function is called.
+ * The macro must be defined alike in every compilation unit (e.g. on the command line).
+ *
+ * Usage:
+ * \code
+ * VT_RING(32) rx_ring;
+ *
+ * ISR(USART_RX_vect) {
+ *   if (!VT_RING_FULL(rx_ring)) VT_RING_PUT(rx_ring, UDR0);
+ *   VT_WAKE(VT_ID(rx));
+ * }
+ *
+ * void rx_thread(void) {
+ *   VT_BEGIN(rx, rx_ip);
+ *   VT_WAIT_READ(rx, rx_ip, rx_ring);
+ *   VT_RING_DRAIN(rx_ring, c) parse(c);
+ *   VT_END(rx);
+ * }
+ * \endcode
+ * \author semicontinuity
+ */
+
+#include <stdint.h>
+#include "vthreads.h"
+#ifdef VT_SCHEDULER_WAITS
+#include "vthreads_scheduler.h"
+#elif defined(__VTHREADS_SCHEDULER_H__)
+#error "vthreads_ring.h is used with the scheduler: define VT_SCHEDULER_WAITS in every compilation unit"
+#endif
+
+
+/**
+ * The type of a ring buffer of the given size.
+ * \param size    The capacity in bytes: a power of two, at most 128
+ */
+#define VT_RING(size)                                                   \
+  struct {                                                              \
+    volatile uint8_t head;                                              \
+    volatile uint8_t tail;                                              \
+    volatile uint8_t data[size];                                        \
+    uint8_t size_check[((size) & ((size) - 1)) == 0 && (size) <= 128 ? 0 : -1]; \
+  }
+
+#define FC_RING_MASK(rb) ((uint8_t)(sizeof((rb).data) - 1))
+
+
+/**
+ * The number of bytes in the ring buffer.
+ */
+#define VT_RING_COUNT(rb) ((uint8_t)((rb).head - (rb).tail))
+
+/**
+ * Check whether the ring buffer is empty.
+ */
+#define VT_RING_EMPTY(rb) ((rb).head == (rb).tail)
+
+/**
+ * Check whether the ring buffer is full.
+ */
+#define VT_RING_FULL(rb) (VT_RING_COUNT(rb) == sizeof((rb).data))
+
+
+/**
+ * Append a byte to the ring buffer; producer side only.
+ * The buffer must not be full.
+ */
+#define VT_RING_PUT(rb, v) do {                 \
+  uint8_t __head = (rb).head;                   \
+  (rb).data[__head & FC_RING_MASK(rb)] = (v);   \
+  (rb).head = __head + 1;                       \
+} while(0)
+
+/**
+ * Remove a byte from the ring buffer and return it; consumer side only.
+ * The buffer must not be empty.
+ */
+#define VT_RING_GET(rb)                         \
+(__extension__({                                \
+  uint8_t __tail = (rb).tail;                   \
+  uint8_t __value = (rb).data[__tail & FC_RING_MASK(rb)]; \
+  (rb).tail = __tail + 1;                       \
+  __value;                                      \
+}))
+
+
+/**
+ * Consume all bytes available in the ring buffer, one loop iteration per byte; consumer side only.
+ * The head index is read once, so bytes that arrive during the loop are left for the next drain.
+ * Leaving the loop with break keeps the current byte in the buffer.
+ * \param rb      The ring buffer
+ * \param var     The variable that receives the byte in every iteration
+ */
+#define VT_RING_DRAIN(rb, var)                                          \
+  for (uint8_t __tail = (rb).tail, __head = (rb).head;                  \
+       __tail != __head && ((var) = (rb).data[__tail & FC_RING_MASK(rb)], 1); \
+       (rb).tail = ++__tail)
+
+
+#ifdef VT_SCHEDULER_WAITS
+#define FC_RING_WAIT(thread, ip, cond) VT_WAIT_EVENT_UNTIL(thread, ip, VT_ID(thread), cond)
+#else
+#define FC_RING_WAIT(thread, ip, cond) VT_WAIT_UNTIL(thread, ip, cond)
+#endif
+
+/**
+ * Yield until the ring buffer has data to read.
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ * \param rb      The ring buffer
+ */
+#define VT_WAIT_READ(thread, ip, rb) FC_RING_WAIT(thread, ip, !VT_RING_EMPTY(rb))
+
+/**
+ * Yield until the ring buffer has space to write.
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ * \param rb      The ring buffer
+ */
+#define VT_WAIT_WRITE(thread, ip, rb) FC_RING_WAIT(thread, ip, !VT_RING_FULL(rb))
+
+#endif
@@ -0,0 +1,473 @@
+#ifndef __VTHREADS_SCHEDULER_H__
+#define __VTHREADS_SCHEDULER_H__
+
+/**
+ * \file
+ * Ready-mask scheduler for a static table of virtual threads.
+ *
+ * Every registered virtual thread owns one bit of the ready mask; the bit number is the thread id.
+ * The dispatcher calls only the threads whose ready bits are set,
+ * lowest id first, so idle threads cost nothing on a pass.
+ *
+ * Configuration (define before including this file):
+ *  - VT_SCHEDULER_SIZE  Maximum number of threads, 8 (default) or 16.
+ *  - VT_READY0          Byte holding the ready bits of threads 0-7.
+ *  - VT_READY1          Byte holding the ready bits of threads 8-15 (only when VT_SCHEDULER_SIZE > 8).
+ *                       By default the ready mask is placed in RAM; for best performance,
+ *                       place it to the general purpose I/O registers (e.g. GPIOR0).
+ *  - VT_READY_IO        Define if VT_READY0 and VT_READY1 are bit-addressable I/O registers (0x00-0x1F).
+ *                       Then setting or clearing the ready bit of a constant id is a single atomic sbi/cbi instruction;
+ *                       otherwise (and for ids known only at run time) updates are wrapped in an atomic block.
+ *  - VT_IDLE_SLEEP_MODE One of SLEEP_MODE_* to enter when no thread is ready (enables vt_idle and vt_run).
+ *                       Without it, vt_run_until_idle can be called from the application's own main loop.
+ *  - VT_STACK           Define to measure the peak stack usage of every thread (see vthreads_stack.h).
+ *  - VT_WATCHDOG        Define to reset the hardware watchdog only while every thread yields within its budget
+ *                       (see vthreads_watchdog.h).
+ *  - VT_SCHEDULER_WAITS Define (in every compilation unit) to make the waits of vthreads_ring.h and vthreads_pool.h
+ *                       clear the ready bit of the waiting thread instead of polling; required when those headers
+ *                       are used together with the scheduler.
+ *  - VT_PRIORITY_LEVELS Number of priority levels, 2 or 4 (enables vt_dispatch_priority);
+ *                       VT_SCHEDULER_SIZE must then be 8 or 16.
+ *                       The ids are split evenly between the levels, the lowest ids forming the highest level
+ *                       (e.g. 16 threads in 2 levels: ids 0-7 and 8-15, one ready byte per level).
+ *
+ * Usage:
+ * \code
+ * VT_THREAD_ID(rx, 0);
+ * VT_THREAD_ID(tx, 1);
+ * VT_SCHEDULER(rx_thread, tx_thread);     // in exactly one compilation unit, in id order
+ *
+ * VT_READY_SET(VT_ID(rx));
+ * for (;;) vt_dispatch();
+ *
+ * ISR(USART_RX_vect) { ...; VT_WAKE(VT_ID(rx)); }
+ * \endcode
+ * \author semicontinuity
+ */
+
+#include <stdint.h>
+#include "vthreads_port.h"
+#ifdef VT_IDLE_SLEEP_MODE
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#endif
+#include "vthreads.h"
+
+
+#ifndef VT_SCHEDULER_SIZE
+#define VT_SCHEDULER_SIZE 8
+#endif
+
+#if VT_SCHEDULER_SIZE > 16
+#error "VT_SCHEDULER_SIZE must not exceed 16"
+#endif
+
+#if defined(VT_PRIORITY_LEVELS) && VT_PRIORITY_LEVELS != 2 && VT_PRIORITY_LEVELS != 4
+#error "VT_PRIORITY_LEVELS must be 2 or 4"
+#endif
+
+/* Every level must lie within one ready byte and all ids must be covered. */
+#if defined(VT_PRIORITY_LEVELS) && VT_SCHEDULER_SIZE != 8 && VT_SCHEDULER_SIZE != 16
+#error "VT_PRIORITY_LEVELS requires VT_SCHEDULER_SIZE of 8 or 16"
+#endif
+
+/* The ring and pool waits included before this file poll, and their wakeups would be missing. */
+#if (defined(__VTHREADS_RING_H__) || defined(__VTHREADS_POOL_H__)) && !defined(VT_SCHEDULER_WAITS)
+#error "vthreads_ring.h or vthreads_pool.h is used with the scheduler: define VT_SCHEDULER_WAITS in every compilation unit"
+#endif
+
+
+/**
+ * A virtual thread function, as registered in the scheduler table.
+ */
+typedef void (*vthread_function_t)(void);
+
+#if VT_SCHEDULER_SIZE > 8
+typedef uint16_t vthread_mask_t;
+#else
+typedef uint8_t vthread_mask_t;
+#endif
+
+
+#ifndef VT_READY0
+#define FC_READY_IN_RAM
+extern volatile uint8_t vt_ready[(VT_SCHEDULER_SIZE + 7) / 8];
+#define VT_READY0 vt_ready[0]
+#if VT_SCHEDULER_SIZE > 8
+#define VT_READY1 vt_ready[1]
+#endif
+#endif
+
+#if VT_SCHEDULER_SIZE > 8
+#define FC_READY_REG(id) (*((id) < 8 ? &VT_READY0 : &VT_READY1))
+#define FC_READY_BIT(id) (1 << ((id) & 7))
+#else
+#define FC_READY_REG(id) VT_READY0
+#define FC_READY_BIT(id) (1 << (id))
+#endif
+
+/*
+ * Update the ready byte of the id without losing the wakeups posted by interrupt handlers.
+ * Only a constant id in a bit-addressable I/O register makes the update a single sbi/cbi;
+ * an id known at run time takes a read-modify-write, which needs interrupts disabled.
+ */
+#ifdef VT_READY_IO
+#define FC_READY_UPDATE(id, statement) do {     \
+  if (__builtin_constant_p(id)) { statement; }  \
+  else ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { statement; } \
+} while(0)
+#else
+#define FC_READY_UPDATE(id, statement) do { ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { statement; } } while(0)
+#endif
+
+
+/**
+ * Declare the scheduler id of the virtual thread.
+ * \param thread  A virtual thread name
+ * \param id      The id of the thread: the number of its ready bit and its index in the scheduler table
+ */
+#define VT_THREAD_ID(thread, id) enum { FC_CONCAT(thread, __ID) = (id) }
+
+/**
+ * The scheduler id of the virtual thread, as declared with VT_THREAD_ID.
+ * \param thread  A virtual thread name
+ */
+#define VT_ID(thread) FC_CONCAT(thread, __ID)
+
+
+/**
+ * Define the scheduler table.
+ * Must be used in exactly one compilation unit.
+ * \param ...     Virtual thread functions, in the order of their ids
+ */
+#define VT_SCHEDULER(...)                                               \
+  FC_SCHEDULER_READY_DEFINITION                                         \
+  FC_SCHEDULER_PASS_DEFINITION                                          \
+  const vthread_function_t vt_threads[] PROGMEM = { __VA_ARGS__ };      \
+  typedef char vt_scheduler_size_check[                                 \
+    sizeof(vt_threads) / sizeof(vt_threads[0]) <= VT_SCHEDULER_SIZE ? 1 : -1]
+
+#ifdef FC_READY_IN_RAM
+#define FC_SCHEDULER_READY_DEFINITION volatile uint8_t vt_ready[(VT_SCHEDULER_SIZE + 7) / 8];
+#else
+#define FC_SCHEDULER_READY_DEFINITION
+#endif
+
+#ifdef VT_PRIORITY_LEVELS
+extern uint8_t vt_pass[VT_PRIORITY_LEVELS];
+#define FC_SCHEDULER_PASS_DEFINITION uint8_t vt_pass[VT_PRIORITY_LEVELS];
+#else
+#define FC_SCHEDULER_PASS_DEFINITION
+#endif
+
+extern const vthread_function_t vt_threads[] PROGMEM;
+
+
+/**
+ * Mark the virtual thread as ready, so that the dispatcher calls it.
+ * With VT_STATS, the wakeup is stamped for the dispatch latency, as with VT_WAKE.
+ * \param id      The id of the virtual thread
+ */
+#define VT_READY_SET(id) FC_READY_UPDATE(id, FC_STATS_WAKE(id); FC_READY_REG(id) |= FC_READY_BIT(id))
+
+/**
+ * Mark the virtual thread as not ready, so that the dispatcher skips it.
+ * \param id      The id of the virtual thread
+ */
+#define VT_READY_CLEAR(id) FC_READY_UPDATE(id, FC_READY_REG(id) &= (uint8_t)~FC_READY_BIT(id))
+
+/**
+ * Check whether the virtual thread is ready.
+ * \param id      The id of the virtual thread
+ */
+#define VT_IS_READY(id) ((FC_READY_REG(id) & FC_READY_BIT(id)) != 0)
+
+
+/**
+ * Mark the virtual thread as ready from an interrupt handler.
+ * With VT_READY_IO and a constant id, this is a single sbi instruction, safe in any context.
+ * Otherwise it relies on interrupts being disabled, as they are in an ordinary (blocking) ISR.
+ * \param id      The id of the virtual thread
+ */
+#define VT_WAKE(id) do { FC_STATS_WAKE(id); FC_READY_REG(id) |= FC_READY_BIT(id); } while(0)
+
+/**
+ * Mark several virtual threads as ready from an interrupt handler.
+ * Relies on interrupts being disabled, as they are in an ordinary (blocking) ISR.
+ * \param mask    The ready bits to set
+ */
+#if VT_SCHEDULER_SIZE > 8
+#define VT_WAKE_MASK(mask) do {                 \
+  vthread_mask_t __mask = (mask);               \
+  FC_STATS_WAKE_MASK(__mask);                   \
+  VT_READY0 |= (uint8_t)__mask;                 \
+  VT_READY1 |= (uint8_t)(__mask >> 8);          \
+} while(0)
+#else
+#define VT_WAKE_MASK(mask) do {                 \
+  vthread_mask_t __mask = (mask);               \
+  FC_STATS_WAKE_MASK(__mask);                   \
+  VT_READY0 |= __mask;                          \
+} while(0)
+#endif
+
+
+/**
+ * Clear the ready bit of the current virtual thread and yield.
+ * The thread is not dispatched until its ready bit is set again (e.g. with VT_WAKE),
+ * and then resumes from the following operator, with the ready bit set.
+ * A wakeup that comes after the bit is cleared is never lost;
+ * a wakeup that came earlier, while the thread was running, is consumed by this wait.
+ * When the wakeup announces some state (data received, flag raised), use VT_WAIT_EVENT_UNTIL.
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ * \param bit     The ready bit (id) of the virtual thread
+ */
+#define VT_WAIT_EVENT(thread, ip, bit)          \
+do {                                            \
+  VT_READY_CLEAR(bit);                          \
+  FC_SUSPEND(ip, FC_CONCAT(FC_LABEL, __LINE__)); \
+} while(0)
+
+
+/**
+ * Wait, with the ready bit cleared, until the condition is true.
+ * The ready bit is cleared before the condition is checked,
+ * so a wakeup that makes the condition true cannot be missed.
+ * Once the condition is true, the ready bit is set again and the thread proceeds.
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ * \param bit     The ready bit (id) of the virtual thread
+ * \param cond    The condition to wait for
+ */
+#define VT_WAIT_EVENT_UNTIL(thread, ip, bit, cond) \
+do {                                            \
+  FC_CONCAT(FC_LABEL, __LINE__):                \
+  FC_MAP_WAIT                                   \
+  VT_READY_CLEAR(bit);                          \
+  if (!(cond)) {                                \
+    FC_HOOK_SUSPEND                             \
+    (ip) = FC_LABEL_ADDRESS(FC_CONCAT(FC_LABEL, __LINE__)); \
+    return;                                     \
+  }                                             \
+  VT_READY_SET(bit);                            \
+} while(0)
+
+
+/**
+ * Read the whole ready mask.
+ */
+static inline vthread_mask_t vt_ready_mask(void) {
+#if VT_SCHEDULER_SIZE > 8
+  return VT_READY0 | ((vthread_mask_t)VT_READY1 << 8);
+#else
+  return VT_READY0;
+#endif
+}
+
+/**
+ * Check whether any virtual thread other than the given one is ready.
+ * With VT_YIELD_IF, lets a thread keep working while it has the CPU to itself.
+ * \param id      The id of the virtual thread
+ */
+#define VT_OTHERS_READY(id) ((vt_ready_mask() & ~((vthread_mask_t)1 << (id))) != 0)
+
+
+/*
+ * The position of the lowest set bit for every nibble value.
+ */
+static const uint8_t vt_lsb_table[16] PROGMEM = {
+  0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0
+};
+
+/**
+ * Find the position of the lowest set bit.
+ * \param mask    A non-zero byte
+ */
+static inline uint8_t vt_lowest_bit(uint8_t mask) {
+  uint8_t low = mask & 0x0F;
+  if (low) return pgm_read_byte(&vt_lsb_table[low]);
+  return 4 + pgm_read_byte(&vt_lsb_table[mask >> 4]);
+}
+
+
+/**
+ * Find the position of the lowest set bit of a ready mask.
+ * \param mask    A non-zero mask
+ */
+static inline uint8_t vt_mask_lowest_bit(vthread_mask_t mask) {
+#if VT_SCHEDULER_SIZE > 8
+  if ((uint8_t)mask) return vt_lowest_bit((uint8_t)mask);
+  return 8 + vt_lowest_bit((uint8_t)(mask >> 8));
+#else
+  return vt_lowest_bit(mask);
+#endif
+}
+
+
+#ifdef VT_STACK
+#include "vthreads_stack.h"
+#else
+#define FC_STACK_ENTER
+#define FC_STACK_LEAVE(id)
+#endif
+
+#ifdef VT_WATCHDOG
+#include "vthreads_watchdog.h"
+#else
+#define FC_WATCHDOG_ENTER(id)
+#define FC_WATCHDOG_LEAVE(id)
+#define FC_WATCHDOG_PASS
+#endif
+
+/**
+ * Call the virtual thread function with the given id.
+ * Always inlined, so that the stack pointer recorded with VT_STACK is that of the dispatcher.
+ * \param id      The id of the virtual thread
+ */
+static inline __attribute__((always_inline)) void vt_call(uint8_t id) {
+  FC_STACK_ENTER
+  FC_WATCHDOG_ENTER(id)
+  ((vthread_function_t)pgm_read_word(&vt_threads[id]))();
+  FC_WATCHDOG_LEAVE(id)
+  FC_STACK_LEAVE(id)
+}
+
+
+/*
+ * Call every thread of the snapshot of one ready byte, lowest bit first.
+ */
+static inline void vt_dispatch_byte(uint8_t pending, uint8_t base) {
+  while (pending) {
+    uint8_t id = base + vt_lowest_bit(pending);
+    pending &= (uint8_t)(pending - 1);
+    vt_call(id);
+  }
+}
+
+
+/**
+ * Make one scheduling pass: call every thread that is ready at the start of the pass once.
+ */
+static inline void vt_dispatch(void) {
+  vt_dispatch_byte(VT_READY0, 0);
+#if VT_SCHEDULER_SIZE > 8
+  vt_dispatch_byte(VT_READY1, 8);
+#endif
+  FC_WATCHDOG_PASS
+}
+
+
+#ifdef VT_PRIORITY_LEVELS
+
+#define FC_LEVEL_WIDTH (VT_SCHEDULER_SIZE / VT_PRIORITY_LEVELS)
+
+/*
+ * Call the next thread of the given level, if any of its threads is ready.
+ * Within a level, the threads that are ready at the start of a pass are called once each, lowest id first;
+ * vt_pass holds those of them that have not been called yet.
+ * Returns 0 if no thread of the level is ready.
+ */
+static inline __attribute__((always_inline)) uint8_t vt_dispatch_level(uint8_t level) {
+  uint8_t base = level * FC_LEVEL_WIDTH;
+  uint8_t ready = (uint8_t)((FC_READY_REG(base) >> (base & 7)) & ((1 << FC_LEVEL_WIDTH) - 1));
+  if (!ready) return 0;
+  uint8_t pass = vt_pass[level] & ready;
+  if (!pass) pass = ready;
+  vt_pass[level] = pass & (uint8_t)(pass - 1);
+  vt_call(base + vt_lowest_bit(pass));
+  return 1;
+}
+
+/**
+ * Call one thread of the highest priority level that has a ready thread.
+ * Since every call starts from the highest level again, a thread of a higher level waits
+ * at most for the slice of one lower-level thread that is already running.
+ * Threads of the same level take turns.
+ */
+static inline void vt_dispatch_priority(void) {
+  do {
+    if (vt_dispatch_level(0)) break;
+#if VT_PRIORITY_LEVELS > 2
+    if (vt_dispatch_level(1)) break;
+    if (vt_dispatch_level(2)) break;
+    vt_dispatch_level(3);
+#else
+    vt_dispatch_level(1);
+#endif
+  } while(0);
+  FC_WATCHDOG_PASS
+}
+
+#define FC_RUN_DISPATCH() vt_dispatch_priority()
+
+#else
+
+#define FC_RUN_DISPATCH() vt_dispatch()
+
+#endif
+
+
+/**
+ * Dispatch the ready virtual threads until none is ready, and return.
+ * Every pass calls the threads that are ready at its start (see vt_dispatch), so the threads woken
+ * during a pass, however many times, are called once on the next pass, without a return to the caller's loop.
+ * Returns only when all threads wait: a thread that yields with its ready bit set keeps it running.
+ * With VT_PRIORITY_LEVELS, dispatches with vt_dispatch_priority.
+ */
+static inline void vt_run_until_idle(void) {
+  while (vt_ready_mask() != 0) FC_RUN_DISPATCH();
+}
+
+
+#ifdef VT_IDLE_SLEEP_MODE
+
+#ifndef VT_IDLE_ENTER
+/**
+ * Hook run with interrupts disabled right before the MCU goes to sleep.
+ * A timer service uses it to program the timer compare to the earliest pending timeout.
+ */
+#define VT_IDLE_ENTER() do {} while(0)
+#endif
+
+#ifndef VT_IDLE_EXIT
+/**
+ * Hook run after the MCU wakes up, before interrupts are enabled again.
+ */
+#define VT_IDLE_EXIT() do {} while(0)
+#endif
+
+/**
+ * Put the MCU to sleep in VT_IDLE_SLEEP_MODE if no virtual thread is ready.
+ * The ready mask is checked with interrupts disabled, and sei is immediately followed by sleep,
+ * so a wakeup posted by an interrupt handler after the check wakes the MCU right away
+ * instead of being slept through.
+ */
+static inline void vt_idle(void) {
+  cli();
+  if (vt_ready_mask() == 0) {
+    VT_IDLE_ENTER();
+    set_sleep_mode(VT_IDLE_SLEEP_MODE);
+    sleep_enable();
+    __asm__ __volatile__ ("sei" "\n\t" "sleep" ::: "memory");
+    sleep_disable();
+    cli();
+    VT_IDLE_EXIT();
+  }
+  sei();
+}
+
+/**
+ * Run the scheduler forever: dispatch until no virtual thread is ready (see vt_run_until_idle), then sleep.
+ * With VT_PRIORITY_LEVELS, dispatches with vt_dispatch_priority.
+ */
+static inline void vt_run(void) {
+  for (;;) {
+    vt_run_until_idle();
+    vt_idle();
+  }
+}
+
+#endif
+
+#endif
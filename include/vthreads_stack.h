@@ -0,0 +1,117 @@
+#ifndef __VTHREADS_STACK_H__
+#define __VTHREADS_STACK_H__
+
+/**
+ * \file
+ * Per-thread stack usage measurement for the ready-mask scheduler.
+ *
+ * Included by vthreads_scheduler.h when VT_STACK is defined; otherwise, the hooks compile to nothing.
+ *
+ * All virtual threads share the C stack. The reserved stack region (the top VT_STACK_SIZE bytes of RAM)
+ * is painted once at startup. After every call of a thread by the dispatcher,
+ * the region is scanned upwards from its bottom to the first byte that is no longer painted:
+ * the distance to the stack pointer at the call is the depth the thread (and any interrupt handler
+ * that came while it ran) has reached. The touched bytes are then painted again,
+ * so that every run is measured on its own.
+ * A call nested in another (the handoff of VT_CHANNEL_HANDOFF) repaints its part before the outer call is measured,
+ * so it passes the lowest byte it has found on to the outer call, which thus includes the whole chain.
+ * The figure of the nested call itself also includes any deeper excursion of the outer call before it.
+ * The scan takes time proportional to the unused part of the region,
+ * and the repaint disables interrupts for a time proportional to the depth; use it in measurement builds.
+ *
+ * Configuration (define before including vthreads_scheduler.h):
+ *  - VT_STACK_SIZE  The size of the reserved stack region, in bytes (default 256).
+ *
+ * Usage:
+ * \code
+ * VT_STACK_TABLE;                         // in exactly one compilation unit
+ *
+ * int main(void) {
+ *   vt_stack_paint();                     // first thing, with interrupts still disabled
+ *   ...
+ *   report(vt_stack_max[VT_ID(rx)]);
+ * }
+ * \endcode
+ * \author semicontinuity
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#ifndef VT_STACK_SIZE
+#define VT_STACK_SIZE 256
+#endif
+
+/**
+ * The value the free stack is painted with.
+ */
+#define VT_STACK_PAINT 0xC5
+
+#define FC_STACK_BOTTOM ((uint8_t *)(RAMEND + 1 - VT_STACK_SIZE))
+
+
+/**
+ * The peak stack usage of every thread, in bytes below the stack pointer of the dispatcher,
+ * including the return address of the call.
+ * A value that equals the distance from the dispatcher to the bottom of the region means that
+ * the thread has overrun VT_STACK_SIZE.
+ */
+extern uint16_t vt_stack_max[VT_SCHEDULER_SIZE];
+
+/*
+ * The lowest stack byte used by the calls nested in the current one, so far (its stack pointer if none).
+ */
+extern uint8_t *vt_stack_low;
+
+/**
+ * Define the stack usage table.
+ * Must be used in exactly one compilation unit.
+ */
+#define VT_STACK_TABLE uint16_t vt_stack_max[VT_SCHEDULER_SIZE]; uint8_t *vt_stack_low
+
+
+/**
+ * Paint the free part of the reserved stack region.
+ * Must be called before interrupts are enabled, from the outermost function (e.g. main).
+ */
+static inline void vt_stack_paint(void) {
+  uint8_t *top = (uint8_t *)SP;
+  for (uint8_t *p = FC_STACK_BOTTOM; p < top; p++) *p = VT_STACK_PAINT;
+}
+
+/*
+ * Measure the stack used by the thread that has just returned to the dispatcher, and paint it again.
+ * Always inlined into vt_call, so that no return address or saved register lies below 'top';
+ * the repaint still stops at the live stack pointer, in case the compiler has pushed anything.
+ * Returns the lowest byte used, for the call that this one is nested in.
+ * \param id      The id of the thread
+ * \param top     The stack pointer at the call of the thread
+ * \param outer   The lowest byte used by the calls nested in the outer call, before this one
+ */
+static inline __attribute__((always_inline)) uint8_t *vt_stack_measure(uint8_t id, uint8_t *top, uint8_t *outer) {
+  uint8_t *p = FC_STACK_BOTTOM;
+  while (p < top && *p == VT_STACK_PAINT) p++;
+  uint8_t *low = p < vt_stack_low ? p : vt_stack_low;
+  uint16_t used = (uint16_t)(top - low);
+  if (used > vt_stack_max[id]) vt_stack_max[id] = used;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint8_t *sp = (uint8_t *)SP;
+    if (sp < top) top = sp + 1;
+    while (p < top) *p++ = VT_STACK_PAINT;
+  }
+  return low < outer ? low : outer;
+}
+
+
+/*
+ * The hooks used by vt_call.
+ */
+#define FC_STACK_ENTER                                  \
+  uint8_t *vt_stack_top = (uint8_t *)SP;                \
+  uint8_t *vt_stack_outer = vt_stack_low;               \
+  vt_stack_low = vt_stack_top;
+
+#define FC_STACK_LEAVE(id) vt_stack_low = vt_stack_measure((id), vt_stack_top, vt_stack_outer);
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef __VTHREADS_STATS_H__
+#define __VTHREADS_STATS_H__
+
+/**
+ * \file
+ * Per-thread run time statistics.
+ *
+ * Included by vthreads.h when VT_STATS is defined; otherwise, all hooks compile to nothing.
+ * Every virtual thread then needs an id declared with VT_THREAD_ID, below VT_STATS_SIZE,
+ * and VT_CLOCK must be defined to read a free-running timer (see VT_YIELD_BUDGET).
+ *
+ * For every thread, the hooks in VT_BEGIN, the yields, and VT_END record:
+ *  - the number of resumes (calls of the thread function),
+ *  - the minimum, maximum, and total run time from the resume to the yield, in VT_CLOCK ticks,
+ *  - the maximum dispatch latency: the time from the wakeup (VT_WAKE, VT_WAKE_MASK, VT_READY_SET) to the resume,
+ *  - the number of passes through the whole thread body.
+ * Yields written in assembly (VT_ASM_YIELD_Z) are not instrumented.
+ *
+ * Usage:
+ * \code
+ * VT_STATS_TABLE;                         // in exactly one compilation unit
+ *
+ * vt_stats_dump(uart_putc);               // send the table, as raw vthread_stats_t structures
+ * VT_STATS_RESET();
+ * \endcode
+ * \author semicontinuity
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef VT_CLOCK
+#error "VT_STATS requires VT_CLOCK"
+#endif
+
+#ifndef VT_STATS_SIZE
+/**
+ * The number of entries in the statistics table; all thread ids must be below it.
+ */
+#define VT_STATS_SIZE 8
+#endif
+
+
+/**
+ * The statistics of one virtual thread.
+ */
+typedef struct {
+  uint16_t resumes;
+  uint16_t passes;
+  VT_CLOCK_T run_min;
+  VT_CLOCK_T run_max;
+  uint32_t run_sum;
+  VT_CLOCK_T latency_max;
+  VT_CLOCK_T woken;
+  uint8_t woken_valid;
+} vthread_stats_t;
+
+extern vthread_stats_t vt_stats[VT_STATS_SIZE];
+
+/**
+ * Define the statistics table.
+ * Must be used in exactly one compilation unit.
+ */
+#define VT_STATS_TABLE vthread_stats_t vt_stats[VT_STATS_SIZE]
+
+/**
+ * Clear the statistics of all threads.
+ */
+#define VT_STATS_RESET() do { memset(vt_stats, 0, sizeof(vt_stats)); } while(0)
+
+
+/*
+ * Called on every resume, with the time the thread function was entered.
+ */
+static inline void vt_stats_resume(uint8_t id, VT_CLOCK_T now) {
+  vthread_stats_t *s = &vt_stats[id];
+  s->resumes++;
+  if (s->woken_valid) {
+    VT_CLOCK_T latency = now - s->woken;
+    if (latency > s->latency_max) s->latency_max = latency;
+    s->woken_valid = 0;
+  }
+}
+
+/*
+ * Called on every yield, with the time the thread function was entered.
+ */
+static inline void vt_stats_suspend(uint8_t id, VT_CLOCK_T start) {
+  vthread_stats_t *s = &vt_stats[id];
+  VT_CLOCK_T run = VT_CLOCK() - start;
+  s->run_sum += run;
+  if (run > s->run_max) s->run_max = run;
+  if (run < s->run_min || s->resumes == 1) s->run_min = run;
+}
+
+/*
+ * Called when the thread is woken up while it is not ready.
+ * Only the first wakeup before a resume is stamped.
+ */
+static inline void vt_stats_woken(uint8_t id) {
+  vthread_stats_t *s = &vt_stats[id];
+  if (!s->woken_valid) {
+    s->woken = VT_CLOCK();
+    s->woken_valid = 1;
+  }
+}
+
+/*
+ * Called for the threads of the mask that are woken up while they are not ready.
+ */
+static inline void vt_stats_woken_mask(uint16_t mask) {
+  for (uint8_t id = 0; mask; id++, mask >>= 1) {
+    if (mask & 1) vt_stats_woken(id);
+  }
+}
+
+/**
+ * Send the statistics table, byte after byte, as raw vthread_stats_t structures.
+ * \param out     The function that sends a byte, e.g. over UART
+ */
+static inline void vt_stats_dump(void (*out)(uint8_t)) {
+  const uint8_t *p = (const uint8_t *)vt_stats;
+  for (uint16_t i = 0; i < sizeof(vt_stats); i++) out(p[i]);
+}
+
+
+/*
+ * The hooks used by vthreads.h and vthreads_scheduler.h.
+ */
+#define FC_STATS_BEGIN(thread)                  \
+  const uint8_t vt_stats_id = VT_ID(thread);    \
+  vt_stats_resume(vt_stats_id, vt_slice);
+
+#define FC_STATS_SUSPEND vt_stats_suspend(vt_stats_id, vt_slice);
+
+#define FC_STATS_END vt_stats[vt_stats_id].passes++;
+
+#define FC_STATS_WAKE(id) do { if (!VT_IS_READY(id)) vt_stats_woken(id); } while(0)
+
+#define FC_STATS_WAKE_MASK(mask) vt_stats_woken_mask((uint16_t)((mask) & ~vt_ready_mask()))
+
+#endif
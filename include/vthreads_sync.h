@@ -0,0 +1,189 @@
+#ifndef __VTHREADS_SYNC_H__
+#define __VTHREADS_SYNC_H__
+
+/**
+ * \file
+ * Events, counting semaphores and barriers for the virtual threads of the ready-mask scheduler.
+ *
+ * Signalling sets the ready bit of the waiting thread, so a waiting thread is not dispatched at all
+ * until it is signalled. Waits clear the ready bit before checking the state (see VT_WAIT_EVENT_UNTIL),
+ * so a signal cannot be missed. All primitives can be signalled both from interrupt handlers
+ * and from virtual threads: the ready bit is set with VT_READY_SET, which is atomic against the wakeups
+ * posted by interrupt handlers (a single sbi with VT_READY_IO and a constant id).
+ * They take no RAM beyond the state itself: a bit, a byte, two bytes for a semaphore, or a mask and a byte for a barrier.
+ * Waiting threads need ids declared with VT_THREAD_ID.
+ *
+ * Usage:
+ * \code
+ * vthread_sem_t frames;
+ *
+ * ISR(INT0_vect) { VT_SEM_SIGNAL(frames, VT_ID(decoder)); }
+ *
+ * void decoder_thread(void) {
+ *   VT_BEGIN(decoder, decoder_ip);
+ *   VT_SEM_WAIT(decoder, decoder_ip, frames);
+ *   decode();
+ *   VT_END(decoder);
+ * }
+ * \endcode
+ * \author semicontinuity
+ */
+
+#include <stdint.h>
+#include "vthreads_port.h"
+#include "vthreads_scheduler.h"
+
+
+/*
+ * Binary events in a byte.
+ * Any non-zero value means the event is signalled.
+ */
+
+/**
+ * Signal the event and wake the waiting thread.
+ * \param ev      The event byte
+ * \param waiter  The id of the waiting virtual thread
+ */
+#define VT_EVENT_SIGNAL(ev, waiter) do { (ev) = 1; VT_READY_SET(waiter); } while(0)
+
+/**
+ * Wait until the event is signalled, then reset it.
+ * Several signals that come before the wait completes are merged into one.
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ * \param ev      The event byte
+ */
+#define VT_EVENT_WAIT(thread, ip, ev)           \
+do {                                            \
+  VT_WAIT_EVENT_UNTIL(thread, ip, VT_ID(thread), (ev) != 0); \
+  (ev) = 0;                                     \
+} while(0)
+
+
+/*
+ * Binary events in a bit.
+ * The bit is set and cleared inside an atomic block, so the events of one byte can be signalled
+ * from any contexts. With VT_EVENT_BIT_IO defined (all event bits are in bit-addressable I/O registers,
+ * e.g. GPIOR0), the block is skipped for a constant bit number, and the update is a single sbi/cbi
+ * that leaves the I flag alone.
+ */
+#ifdef VT_EVENT_BIT_IO
+#define FC_EVENT_BIT_UPDATE(bit, statement) do {          \
+  if (__builtin_constant_p(bit)) { statement; }           \
+  else ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { statement; }   \
+} while(0)
+#else
+#define FC_EVENT_BIT_UPDATE(bit, statement) do { ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { statement; } } while(0)
+#endif
+
+/**
+ * Signal the event bit and wake the waiting thread.
+ * \param reg     The register or byte holding the event bit
+ * \param bit     The number of the event bit
+ * \param waiter  The id of the waiting virtual thread
+ */
+#define VT_EVENT_BIT_SIGNAL(reg, bit, waiter) do {        \
+  FC_EVENT_BIT_UPDATE(bit, (reg) |= (1 << (bit)));     \
+  VT_READY_SET(waiter);                                 \
+} while(0)
+
+/**
+ * Wait until the event bit is signalled, then reset it.
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ * \param reg     The register or byte holding the event bit
+ * \param bit     The number of the event bit
+ */
+#define VT_EVENT_BIT_WAIT(thread, ip, reg, bit) \
+do {                                            \
+  VT_WAIT_EVENT_UNTIL(thread, ip, VT_ID(thread), (reg) & (1 << (bit))); \
+  FC_EVENT_BIT_UPDATE(bit, (reg) &= (uint8_t)~(1 << (bit))); \
+} while(0)
+
+
+/**
+ * A counting semaphore.
+ * The signalling side only increments 'posted', the waiting side only increments 'taken',
+ * so neither needs interrupts disabled: all signals of a semaphore must come from one context
+ * (interrupt handlers, or virtual threads), while any virtual threads may wait.
+ * The waiter's ready bit is set with VT_READY_SET, which is safe in either context.
+ * Up to 255 signals can be outstanding.
+ */
+typedef struct {
+  volatile uint8_t posted;
+  uint8_t taken;
+} vthread_sem_t;
+
+/**
+ * The number of outstanding signals of the semaphore.
+ */
+#define VT_SEM_COUNT(sem) ((uint8_t)((sem).posted - (sem).taken))
+
+/**
+ * Signal the semaphore and wake the waiting thread.
+ * \param sem     The semaphore
+ * \param waiter  The id of the waiting virtual thread
+ */
+#define VT_SEM_SIGNAL(sem, waiter) do { (sem).posted++; VT_READY_SET(waiter); } while(0)
+
+/**
+ * Wait until the semaphore has an outstanding signal, then take it.
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ * \param sem     The semaphore
+ */
+#define VT_SEM_WAIT(thread, ip, sem)            \
+do {                                            \
+  VT_WAIT_EVENT_UNTIL(thread, ip, VT_ID(thread), VT_SEM_COUNT(sem) != 0); \
+  (sem).taken++;                                \
+} while(0)
+
+
+/**
+ * A barrier: the waiting thread proceeds when all threads of the group have arrived.
+ * 'pending' holds the ready bits of the threads that have not arrived yet,
+ * 'waiter' is the id of the waiting thread.
+ */
+typedef struct {
+  volatile vthread_mask_t pending;
+  uint8_t waiter;
+} vthread_barrier_t;
+
+/**
+ * Report the arrival of the virtual thread at the barrier.
+ * The last thread of the group to arrive wakes the waiting thread; arrivals of threads that are not pending
+ * (at a barrier that has completed or was never armed) change nothing.
+ * Interrupts are disabled for the few cycles of the update, so threads in interrupt handlers can arrive too.
+ * \param barrier The barrier
+ * \param id      The id of the arriving virtual thread
+ */
+#define VT_BARRIER_ARRIVE(barrier, id) do {     \
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {           \
+    vthread_mask_t __bit = (vthread_mask_t)1 << (id); \
+    vthread_mask_t __pending = (barrier).pending; \
+    if (__pending & __bit) {                    \
+      __pending &= (vthread_mask_t)~__bit;      \
+      (barrier).pending = __pending;            \
+      if (!__pending) VT_WAKE((barrier).waiter); \
+    }                                           \
+  }                                             \
+} while(0)
+
+/**
+ * Wait until all virtual threads of the mask have arrived at the barrier (fan-in join).
+ * The barrier is armed with the mask when the wait is reached, so earlier arrivals are not counted:
+ * start the threads of the group (e.g. with VT_WAKE_MASK) right before the wait, in the same pass.
+ * Until the last thread arrives, the waiting thread is not dispatched.
+ * \param thread  A virtual thread name
+ * \param ip      An instruction pointer of the virtual thread
+ * \param barrier The barrier
+ * \param mask    The ready bits of the threads of the group
+ */
+#define VT_WAIT_ALL(thread, ip, barrier, mask)  \
+do {                                            \
+  (barrier).waiter = VT_ID(thread);             \
+  (barrier).pending = (mask);                   \
+  VT_WAIT_EVENT_UNTIL(thread, ip, VT_ID(thread), (barrier).pending == 0); \
+} while(0)
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef __VTHREADS_TIMER_H__
+#define __VTHREADS_TIMER_H__
+
+/**
+ * \file
+ * Delay service for the virtual threads of the ready-mask scheduler.
+ *
+ * Pending timeouts are kept in a hashing timer wheel: a thread that waits for the tick T
+ * has its bit set in the slot T % VT_TIMER_SLOTS.
+ * On every tick, only the threads of the current slot are checked,
+ * and the expired ones get their ready bits set; a delayed thread is never dispatched before it is due.
+ *
+ * Configuration (define before including this file):
+ *  - VT_TIMER_SLOTS     Number of wheel slots, a power of two (default 8).
+ *  - VT_TIMER_TICKLESS  Define to stop the periodic tick while the scheduler sleeps (requires VT_IDLE_SLEEP_MODE).
+ *                       Then the application provides:
+ *                       VT_TIMER_IDLE_BEGIN(ticks) - reprogram the timer to interrupt once after the given
+ *                                                    number of ticks (0: no timeout pending, stop the timer);
+ *                       VT_TIMER_IDLE_END()        - return the number of whole ticks elapsed since
+ *                                                    VT_TIMER_IDLE_BEGIN and restore the periodic tick.
+ *
+ * Usage:
+ * \code
+ * VT_TIMER_SERVICE;                       // in exactly one compilation unit
+ *
+ * ISR(TIMER0_COMPA_vect) { vt_timer_tick(); }
+ *
+ * void blink(void) {
+ *   VT_BEGIN(blink, blink_ip);
+ *   PINB = _BV(PB5);
+ *   VT_DELAY(blink, blink_ip, 500);
+ *   VT_END(blink);
+ * }
+ * \endcode
+ * \author semicontinuity
+ */
+
+#ifdef VT_TIMER_TICKLESS
+#ifndef VT_IDLE_SLEEP_MODE
+#error "VT_TIMER_TICKLESS requires VT_IDLE_SLEEP_MODE"
+#endif
+#ifdef __VTHREADS_SCHEDULER_H__
+#error "vthreads_timer.h must be included before vthreads_scheduler.h when VT_TIMER_TICKLESS is defined"
+#endif
+static inline void vt_timer_idle_enter(void);
+static inline void vt_timer_idle_exit(void);
+#define VT_IDLE_ENTER() vt_timer_idle_enter()
+#define VT_IDLE_EXIT()  vt_timer_idle_exit()
+#endif
+
+#include <stdint.h>
+#include "vthreads_port.h"
+#include "vthreads_scheduler.h"
+
+
+#ifndef VT_TIMER_SLOTS
+#define VT_TIMER_SLOTS 8
+#endif
+
+#if VT_TIMER_SLOTS & (VT_TIMER_SLOTS - 1)
+#error "VT_TIMER_SLOTS must be a power of two"
+#endif
+
+
+extern volatile uint16_t vt_timer_now;
+extern uint16_t vt_timer_deadline[VT_SCHEDULER_SIZE];
+extern vthread_mask_t vt_timer_slot[VT_TIMER_SLOTS];
+extern vthread_mask_t vt_timer_pending;
+#ifdef VT_TIMER_TICKLESS
+extern uint8_t vt_timer_idle;
+#define FC_TIMER_IDLE_DEFINITION uint8_t vt_timer_idle;
+#else
+#define FC_TIMER_IDLE_DEFINITION
+#endif
+
+/**
+ * Define the timer service state.
+ * Must be used in exactly one compilation unit.
+ */
+#define VT_TIMER_SERVICE                                \
+  volatile uint16_t vt_timer_now;                       \
+  uint16_t vt_timer_deadline[VT_SCHEDULER_SIZE];        \
+  vthread_mask_t vt_timer_slot[VT_TIMER_SLOTS];         \
+  vthread_mask_t vt_timer_pending;                      \
+  FC_TIMER_IDLE_DEFINITION                              \
+  typedef char vt_timer_service_defined
+
+
+#define FC_TIMER_MASK(id) ((vthread_mask_t)1 << (id))
+
+
+/**
+ * Clear the ready bit of the virtual thread and set it again after the given number of ticks.
+ * A pending timeout of the thread is replaced.
+ * \param id      The id of the virtual thread
+ * \param ticks   The delay, 1..65535 ticks
+ */
+static inline void vt_timer_start(uint8_t id, uint16_t ticks) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint16_t deadline = vt_timer_now + ticks;
+    FC_READY_REG(id) &= (uint8_t)~FC_READY_BIT(id);
+    if (vt_timer_pending & FC_TIMER_MASK(id)) {
+      vt_timer_slot[vt_timer_deadline[id] & (VT_TIMER_SLOTS - 1)] &= ~FC_TIMER_MASK(id);
+    }
+    vt_timer_deadline[id] = deadline;
+    vt_timer_slot[deadline & (VT_TIMER_SLOTS - 1)] |= FC_TIMER_MASK(id);
+    vt_timer_pending |= FC_TIMER_MASK(id);
+  }
+}
+
+/**
+ * Cancel the pending timeout of the virtual thread, if any.
+ * \param id      The id of the virtual thread
+ */
+static inline void vt_timer_cancel(uint8_t id) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    vt_timer_slot[vt_timer_deadline[id] & (VT_TIMER_SLOTS - 1)] &= ~FC_TIMER_MASK(id);
+    vt_timer_pending &= ~FC_TIMER_MASK(id);
+  }
+}
+
+/**
+ * Check whether the virtual thread has no pending timeout (it has expired or was never started).
+ * \param id      The id of the virtual thread
+ */
+static inline uint8_t vt_timer_expired(uint8_t id) {
+  return (vt_timer_pending & FC_TIMER_MASK(id)) == 0;
+}
+
+
+/**
+ * Suspend the current virtual thread for the given number of ticks.
+ * The thread is not dispatched until the delay expires
+ * (unless its ready bit is set by something else, in which case it resumes early,
+ * and the timeout is cancelled, so that it does not wake the thread later in an unrelated wait).
+ * Once the virtual thread function is called again, it will resume from the following operator.
+ * \param thread  A virtual thread name (with an id declared by VT_THREAD_ID)
+ * \param ip      An instruction pointer of the virtual thread
+ * \param ticks   The delay, 1..65535 ticks
+ */
+#define VT_DELAY(thread, ip, ticks)             \
+do {                                            \
+  vt_timer_start(VT_ID(thread), (ticks));       \
+  FC_SUSPEND(ip, FC_CONCAT(FC_LABEL, __LINE__)); \
+  if (!vt_timer_expired(VT_ID(thread))) vt_timer_cancel(VT_ID(thread)); \
+} while(0)
+
+
+/**
+ * Advance the timer by one tick and wake the threads whose delays have expired.
+ * Must be called from the periodic timer interrupt handler.
+ */
+static inline void vt_timer_tick(void) {
+#ifdef VT_TIMER_TICKLESS
+  if (vt_timer_idle) return;
+#endif
+  uint16_t now = vt_timer_now + 1;
+  vt_timer_now = now;
+
+  vthread_mask_t *slot = &vt_timer_slot[now & (VT_TIMER_SLOTS - 1)];
+  vthread_mask_t pending = *slot;
+  if (!pending) return;
+
+  vthread_mask_t expired = 0;
+  do {
+    uint8_t id = vt_mask_lowest_bit(pending);
+    pending &= (vthread_mask_t)(pending - 1);
+    if (vt_timer_deadline[id] == now) expired |= FC_TIMER_MASK(id);
+  } while (pending);
+
+  *slot &= ~expired;
+  vt_timer_pending &= ~expired;
+  VT_WAKE_MASK(expired);
+}
+
+
+#ifdef VT_TIMER_TICKLESS
+
+/*
+ * Stretch the timer to the earliest pending timeout before the scheduler sleeps.
+ * Called with interrupts disabled.
+ */
+static inline void vt_timer_idle_enter(void) {
+  uint16_t earliest = 0;
+  vthread_mask_t pending = vt_timer_pending;
+  while (pending) {
+    uint8_t id = vt_mask_lowest_bit(pending);
+    pending &= (vthread_mask_t)(pending - 1);
+    uint16_t ticks = vt_timer_deadline[id] - vt_timer_now;
+    if (earliest == 0 || ticks < earliest) earliest = ticks;
+  }
+  vt_timer_idle = 1;
+  VT_TIMER_IDLE_BEGIN(earliest);
+}
+
+/*
+ * Account for the ticks slept through and wake every thread whose timeout has passed.
+ * Called with interrupts disabled.
+ */
+static inline void vt_timer_idle_exit(void) {
+  uint16_t now = vt_timer_now + (uint16_t)(VT_TIMER_IDLE_END());
+  vt_timer_now = now;
+  vt_timer_idle = 0;
+
+  vthread_mask_t expired = 0;
+  vthread_mask_t pending = vt_timer_pending;
+  while (pending) {
+    uint8_t id = vt_mask_lowest_bit(pending);
+    pending &= (vthread_mask_t)(pending - 1);
+    if ((int16_t)(vt_timer_deadline[id] - now) <= 0) {
+      vt_timer_slot[vt_timer_deadline[id] & (VT_TIMER_SLOTS - 1)] &= ~FC_TIMER_MASK(id);
+      expired |= FC_TIMER_MASK(id);
+    }
+  }
+  vt_timer_pending &= ~expired;
+  VT_WAKE_MASK(expired);
+}
+
+#endif
+
+#endif
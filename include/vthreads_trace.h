@@ -0,0 +1,115 @@
+#ifndef __VTHREADS_TRACE_H__
+#define __VTHREADS_TRACE_H__
+
+/**
+ * \file
+ * Trace of the resumes and yields of virtual threads.
+ *
+ * Included by vthreads.h when VT_TRACE is defined; otherwise, all hooks compile to nothing.
+ * Every virtual thread then needs an id declared with VT_THREAD_ID (0..15),
+ * and VT_CLOCK must be defined to read a free-running timer (see VT_YIELD_BUDGET).
+ *
+ * Every resume and yield appends an entry to a ring in SRAM, overwriting the oldest one.
+ * An entry is two words: the point, (thread id << 12) | (source line & 0xFFF), which is a constant,
+ * and the VT_CLOCK timestamp. A resume is logged with the line of VT_BEGIN; a yield, with the line of the yield.
+ * The ring is placed in .noinit, so it survives a watchdog reset and can be dumped afterwards.
+ * Yields written in assembly (VT_ASM_YIELD_Z) are not traced.
+ *
+ * tools/vt_trace.py decodes a dump back into source locations.
+ *
+ * Configuration (define before including vthreads.h):
+ *  - VT_TRACE_SIZE  Number of entries in the ring, a power of two up to 256 (default 32).
+ *
+ * Usage:
+ * \code
+ * VT_TRACE_BUFFER;                        // in exactly one compilation unit
+ *
+ * if (MCUSR & _BV(PORF)) VT_TRACE_RESET(); // after power-on, the ring holds garbage
+ * ...
+ * vt_trace_dump(uart_putc);               // send the entries, oldest first
+ * \endcode
+ * \author semicontinuity
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "vthreads_port.h"
+
+#ifndef VT_CLOCK
+#error "VT_TRACE requires VT_CLOCK"
+#endif
+
+#ifndef VT_TRACE_SIZE
+#define VT_TRACE_SIZE 32
+#endif
+
+#if (VT_TRACE_SIZE & (VT_TRACE_SIZE - 1)) || VT_TRACE_SIZE > 256
+#error "VT_TRACE_SIZE must be a power of two, up to 256"
+#endif
+
+
+/**
+ * A trace entry.
+ */
+typedef struct {
+  uint16_t point;
+  VT_CLOCK_T time;
+} vthread_trace_t;
+
+extern vthread_trace_t vt_trace[VT_TRACE_SIZE];
+extern uint8_t vt_trace_head;
+
+/**
+ * Define the trace ring.
+ * Must be used in exactly one compilation unit.
+ */
+#define VT_TRACE_BUFFER                                                         \
+  vthread_trace_t vt_trace[VT_TRACE_SIZE] __attribute__((section(".noinit")));  \
+  uint8_t vt_trace_head __attribute__((section(".noinit")))
+
+/**
+ * Clear the trace ring.
+ */
+#define VT_TRACE_RESET() do { memset(vt_trace, 0, sizeof(vt_trace)); vt_trace_head = 0; } while(0)
+
+
+/*
+ * Append an entry to the ring.
+ * Interrupts are disabled for the few cycles of the append, so that threads in interrupt handlers can be traced too.
+ */
+static inline void vt_trace_append(uint16_t point, VT_CLOCK_T time) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint8_t head = vt_trace_head;
+    vthread_trace_t *entry = &vt_trace[head & (VT_TRACE_SIZE - 1)];
+    entry->point = point;
+    entry->time = time;
+    vt_trace_head = head + 1;
+  }
+}
+
+/**
+ * Send the entries of the ring, oldest first, byte after byte, as raw vthread_trace_t structures.
+ * Entries with the point 0 have never been written.
+ * \param out     The function that sends a byte, e.g. over UART
+ */
+static inline void vt_trace_dump(void (*out)(uint8_t)) {
+  uint8_t head = vt_trace_head;
+  for (uint16_t i = 0; i < VT_TRACE_SIZE; i++) {
+    const uint8_t *p = (const uint8_t *)&vt_trace[(uint8_t)(head + i) & (VT_TRACE_SIZE - 1)];
+    for (uint8_t j = 0; j < sizeof(vthread_trace_t); j++) out(p[j]);
+  }
+}
+
+
+#define FC_TRACE_POINT(id, line) ((uint16_t)(((id) << 12) | ((line) & 0xFFF)))
+
+/*
+ * The hooks used by vthreads.h.
+ */
+#define FC_TRACE_BEGIN(thread)                          \
+  enum { vt_trace_id = VT_ID(thread) };                 \
+  vt_trace_append(FC_TRACE_POINT(vt_trace_id, __LINE__), vt_slice);
+
+#define FC_TRACE_SUSPEND vt_trace_append(FC_TRACE_POINT(vt_trace_id, __LINE__), VT_CLOCK());
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef __VTHREADS_WATCHDOG_H__
+#define __VTHREADS_WATCHDOG_H__
+
+/**
+ * \file
+ * Cooperative watchdog for the ready-mask scheduler.
+ *
+ * Included by vthreads_scheduler.h when VT_WATCHDOG is defined; otherwise, the hooks compile to nothing.
+ * VT_CLOCK must be defined to read a free-running timer (see VT_YIELD_BUDGET).
+ *
+ * Every thread has a budget: the longest time, in VT_CLOCK ticks, that a call of the thread may take until it yields.
+ * The dispatcher times every call, and resets the hardware watchdog after a pass
+ * (after a call, with vt_dispatch_priority) only as long as no call has overrun its budget.
+ * After the first overrun the watchdog is not reset any more, so a thread that runs away between yields,
+ * or one that returns too late, leads to a watchdog reset.
+ *
+ * To find the culprit, call vt_watchdog_check from a periodic interrupt handler (e.g. a timer compare):
+ * when the running thread is over its budget, the overrun is recorded in vt_watchdog_overrun:
+ * the thread id, the line of the last VT_MARK passed in the slice, and the time taken so far.
+ * The record is placed in .noinit, so it survives the watchdog reset. Only the first overrun is recorded.
+ * The period of the check must be shorter than the wrap period of VT_CLOCK.
+ *
+ * A call nested in another (the handoff of VT_CHANNEL_HANDOFF) is timed against the budget of its own thread;
+ * meanwhile, the outer call is suspended, and the time of the nested call does not count against the outer one.
+ *
+ * Sleeping in vt_idle does not count as a call, but the watchdog is not reset while the MCU sleeps either:
+ * some interrupt must wake it up more often than the watchdog timeout.
+ *
+ * Configuration (define before including vthreads_scheduler.h):
+ *  - VT_WATCHDOG_PET()  Resets the hardware watchdog (default: wdt_reset() on AVR).
+ *
+ * Usage:
+ * \code
+ * VT_WATCHDOG_BUDGETS(400, 2000, 0);      // in exactly one compilation unit, in id order (0: not checked)
+ *
+ * ISR(TIMER1_COMPA_vect) { OCR1A += 1000; vt_watchdog_check(); }
+ *
+ * int main(void) {
+ *   if (MCUSR & _BV(PORF)) VT_WATCHDOG_CLEAR(); // after power-on, the record holds garbage
+ *   if (vt_watchdog_overrun.thread != VT_WATCHDOG_NONE) {
+ *     report(vt_watchdog_overrun.thread, vt_watchdog_overrun.line);
+ *     VT_WATCHDOG_CLEAR();
+ *   }
+ *   wdt_enable(WDTO_60MS);
+ *   ...
+ * }
+ * \endcode
+ * \author semicontinuity
+ */
+
+#include <stdint.h>
+#include "vthreads_port.h"
+
+#ifndef VT_CLOCK
+#error "VT_WATCHDOG requires VT_CLOCK"
+#endif
+
+#ifndef VT_WATCHDOG_PET
+#ifdef __AVR__
+#include <avr/wdt.h>
+#define VT_WATCHDOG_PET() wdt_reset()
+#else
+#error "VT_WATCHDOG requires VT_WATCHDOG_PET"
+#endif
+#endif
+
+
+/**
+ * The thread id that means "no thread".
+ */
+#define VT_WATCHDOG_NONE 0xFF
+
+/**
+ * An overrun record.
+ */
+typedef struct {
+  uint8_t thread;
+  uint16_t line;
+  VT_CLOCK_T elapsed;
+} vthread_overrun_t;
+
+extern const VT_CLOCK_T vt_watchdog_budget[VT_SCHEDULER_SIZE] PROGMEM;
+extern vthread_overrun_t vt_watchdog_overrun;
+extern volatile uint8_t vt_watchdog_thread;
+extern volatile VT_CLOCK_T vt_watchdog_start;
+extern uint8_t vt_watchdog_failed;
+
+/**
+ * Define the budgets of the threads and the watchdog state.
+ * Must be used in exactly one compilation unit.
+ * \param ...     The budgets of the threads in VT_CLOCK ticks, in the order of their ids; 0 means not checked
+ */
+#define VT_WATCHDOG_BUDGETS(...)                                                        \
+  const VT_CLOCK_T vt_watchdog_budget[VT_SCHEDULER_SIZE] PROGMEM = { __VA_ARGS__ };     \
+  vthread_overrun_t vt_watchdog_overrun __attribute__((section(".noinit")));            \
+  volatile uint8_t vt_watchdog_thread = VT_WATCHDOG_NONE;                               \
+  volatile VT_CLOCK_T vt_watchdog_start;                                                \
+  volatile uint16_t vt_watchdog_line;                                                   \
+  uint8_t vt_watchdog_failed;                                                           \
+  typedef char vt_watchdog_clock_check[sizeof(VT_CLOCK_T) <= 2 ? 1 : -1]
+
+/**
+ * Clear the overrun record.
+ */
+#define VT_WATCHDOG_CLEAR() do { vt_watchdog_overrun.thread = VT_WATCHDOG_NONE; } while(0)
+
+#define FC_WATCHDOG_BUDGET(id) ((VT_CLOCK_T)pgm_read_word(&vt_watchdog_budget[id]))
+
+
+/*
+ * Stop resetting the watchdog, and record the overrun, unless one is recorded already.
+ */
+static inline void vt_watchdog_record(uint8_t id, VT_CLOCK_T elapsed) {
+  vt_watchdog_failed = 1;
+  if (vt_watchdog_overrun.thread == VT_WATCHDOG_NONE) {
+    vt_watchdog_overrun.line = vt_watchdog_line;
+    vt_watchdog_overrun.elapsed = elapsed;
+    vt_watchdog_overrun.thread = id;
+  }
+}
+
+/**
+ * Check whether the thread being called by the dispatcher is over its budget, and record the overrun if so.
+ * Must be called from an interrupt handler, with interrupts disabled.
+ * Returns 1 if the running thread is over its budget.
+ */
+static inline uint8_t vt_watchdog_check(void) {
+  uint8_t id = vt_watchdog_thread;
+  if (id == VT_WATCHDOG_NONE) return 0;
+  VT_CLOCK_T budget = FC_WATCHDOG_BUDGET(id);
+  VT_CLOCK_T elapsed = (VT_CLOCK_T)(VT_CLOCK() - vt_watchdog_start);
+  if (!budget || elapsed <= budget) return 0;
+  vt_watchdog_record(id, elapsed);
+  return 1;
+}
+
+/*
+ * The state of the call being timed, saved by a nested vt_call (e.g. the handoff of VT_CHANNEL_HANDOFF).
+ */
+typedef struct {
+  uint8_t thread;
+  uint16_t line;
+  VT_CLOCK_T start;
+} vthread_watchdog_call_t;
+
+/*
+ * Start timing the call of the thread, and return the state of the call it is nested in, if any.
+ * The start time is written while the running thread is none, so vt_watchdog_check never sees it half-written.
+ */
+static inline vthread_watchdog_call_t vt_watchdog_enter(uint8_t id) {
+  vthread_watchdog_call_t outer;
+  outer.thread = vt_watchdog_thread;
+  vt_watchdog_thread = VT_WATCHDOG_NONE;
+  outer.line = vt_watchdog_line;
+  outer.start = vt_watchdog_start;
+  vt_watchdog_line = 0;
+  vt_watchdog_start = VT_CLOCK();
+  vt_watchdog_thread = id;
+  return outer;
+}
+
+/*
+ * Check the call of the thread that has just returned to the dispatcher.
+ * The running thread is cleared first, so that vt_watchdog_check does not record the same call.
+ * Then the timing of the outer call, if any, is resumed, with the time of the nested call excluded.
+ */
+static inline void vt_watchdog_leave(uint8_t id, vthread_watchdog_call_t outer) {
+  VT_CLOCK_T elapsed = (VT_CLOCK_T)(VT_CLOCK() - vt_watchdog_start);
+  vt_watchdog_thread = VT_WATCHDOG_NONE;
+  VT_CLOCK_T budget = FC_WATCHDOG_BUDGET(id);
+  if (budget && elapsed > budget) vt_watchdog_record(id, elapsed);
+  if (outer.thread != VT_WATCHDOG_NONE) {
+    vt_watchdog_line = outer.line;
+    vt_watchdog_start = (VT_CLOCK_T)(outer.start + elapsed);
+    vt_watchdog_thread = outer.thread;
+  }
+}
+
+
+/*
+ * The hooks used by the dispatcher.
+ */
+#define FC_WATCHDOG_ENTER(id) vthread_watchdog_call_t vt_watchdog_outer = vt_watchdog_enter(id);
+
+#define FC_WATCHDOG_LEAVE(id) vt_watchdog_leave((id), vt_watchdog_outer);
+
+#define FC_WATCHDOG_PASS if (!vt_watchdog_failed) VT_WATCHDOG_PET();
+
+#endif
@@ -0,0 +1,311 @@
+#!/usr/bin/env python3
+#
+# Yield-point map of the virtual threads of an AVR program (see VT_MAP in include/vthreads.h).
+#
+# Disassembles the ELF file and prints, for every thread, the flash size of its thread function,
+# the cycles of the resume (from the call of the thread function to the jump to the resume point),
+# and, for every segment (the code from a resume point to the return of the thread function),
+# the worst-case cycle count:
+#   thread   - the name from the <thread>__BEGIN label
+#   segment  - BEGIN, a mark name, or L<line> for the resume point of the yield at that line
+#   cycles   - the longest path, in cycles, including the called functions and the final ret
+#   notes    - "icall" or "ijmp" if the path has indirect calls or jumps, whose targets are not counted,
+#              or "loop at 0x..." if it has a loop that does not pass a yield point (then the cycles are unbounded)
+#
+# The resume points are labelled only in the code compiled with VT_MAP defined;
+# without it, only BEGIN and the marks are listed.
+# A path that falls into the resume point of a VT_YIELD always suspends there: it is counted up to
+# the shortest way from that point to a return. A path that falls into the resume point of a wait
+# (VT_WAIT_UNTIL, VT_WAIT_EVENT_UNTIL and the waits built on them, VT_SPAWN) may find the condition true
+# and proceed, so both ways are followed; a loop through a wait and no yield is reported as unbounded.
+# The cycle counts are for the classic AVR core (ATmega); --pc22 selects the three-byte PC of devices over 128 KB.
+#
+# Usage: vt_map.py [--objdump PROG] [--listing] [--pc22] [--budget SPEC]... [--sources SOURCE]... FILE
+#   --objdump PROG  the disassembler (default avr-objdump)
+#   --listing       FILE is the output of "avr-objdump -t -d", not an ELF file
+#   --pc22          the device has a 22-bit program counter (e.g. ATmega2560)
+#   --budget SPEC   THREAD=CYCLES for all segments of the thread, or THREAD:SEGMENT=CYCLES for one;
+#                   the exit status is 1 if any segment is over its budget (or unbounded)
+#   --sources SOURCE a C source of the virtual threads, to show the source text of the resume points
+#
+# Example, as a post-link step:
+#   avr-gcc -DVT_MAP ... -o app.elf && vt_map.py --budget rx=400 app.elf
+
+import argparse
+import re
+import subprocess
+import sys
+
+SYMBOL = re.compile(r'^([0-9a-f]+)\s(.{7})\s(\S+)\t([0-9a-f]+)\s+(\S+)$')
+INSTRUCTION = re.compile(r'^\s*([0-9a-f]+):\t((?:[0-9a-f]{2} )+)\s*\t(\S+)\s*([^;]*?)\s*(?:;\s*(.*))?$')
+BEGIN = re.compile(r'^(\w+)__BEGIN$')
+YIELD = re.compile(r'^vt__(yield|wait)_(\d+)_\d+$')
+THREAD_BEGIN = re.compile(r'\bVT_(?:ISR(?:_NAKED)?\s*\(\s*\w+\s*,|BEGIN\w*\s*\()\s*(\w+)')
+
+ONE = set('''add adc sub subi sbc sbci and andi or ori eor com neg sbr cbr inc dec tst clr ser
+    cp cpc cpi mov movw ldi in out lsl lsr rol ror asr swap bset bclr bst bld
+    sec clc sen cln sez clz sei cli ses cls sev clv set clt seh clh sbr nop sleep wdr break des'''.split())
+TWO = set('''adiw sbiw mul muls mulsu fmul fmuls fmulsu ld ldd lds st std sts push pop sbi cbi
+    ijmp eijmp xch las lac lat'''.split())
+THREE = set('lpm elpm spm'.split())
+BRANCH = set('''brbs brbc breq brne brcs brcc brsh brlo brmi brpl brge brlt brhs brhc brts brtc
+    brvs brvc brie brid'''.split())
+SKIP = set('cpse sbrc sbrs sbic sbis'.split())
+
+
+class Instruction:
+    def __init__(self, address, size, mnemonic, operands, comment):
+        self.address = address
+        self.size = size
+        self.mnemonic = mnemonic
+        self.operands = operands
+        self.comment = comment
+
+    def target(self):
+        match = re.match(r'0x([0-9a-f]+)', self.comment or '')
+        if match:
+            return int(match.group(1), 16)
+        match = re.match(r'\.([+-]\d+)', self.operands)
+        if match:
+            return self.address + self.size + int(match.group(1))
+        match = re.match(r'0x([0-9a-f]+)', self.operands)
+        return int(match.group(1), 16) if match else None
+
+
+def read_listing(args):
+    if args.listing:
+        return open(args.file, errors='replace').read()
+    try:
+        return subprocess.run([args.objdump, '-t', '-d', args.file], check=True,
+                              stdout=subprocess.PIPE, universal_newlines=True).stdout
+    except (OSError, subprocess.CalledProcessError) as e:
+        sys.exit('vt_map: cannot disassemble %s: %s' % (args.file, e))
+
+
+def parse_listing(text):
+    """Return the code symbols (address, name, size, is_function) and the instructions by address."""
+    symbols = []
+    code = {}
+    for line in text.splitlines():
+        match = SYMBOL.match(line)
+        if match:
+            address, flags, section, size, name = match.groups()
+            symbols.append((int(address, 16), name, int(size, 16), 'F' in flags))
+            continue
+        match = INSTRUCTION.match(line)
+        if match:
+            address, data, mnemonic, operands, comment = match.groups()
+            address = int(address, 16)
+            code[address] = Instruction(address, len(data.split()), mnemonic, operands, comment)
+    return [symbol for symbol in symbols if symbol[0] in code], code
+
+
+class Analyzer:
+    def __init__(self, code, pc22):
+        self.code = code
+        self.stops = set()              # resume points of yields: a path that falls into one suspends there
+        self.pc22 = pc22
+        self.memo = {}
+        self.calls = {}
+
+    def cost(self, insn):
+        m = insn.mnemonic
+        if m in ONE:
+            return 1
+        if m in TWO:
+            return 2
+        if m in THREE:
+            return 3
+        if m == 'rjmp':
+            return 2
+        if m == 'jmp':
+            return 3
+        if m == 'rcall':
+            return 4 if self.pc22 else 3
+        if m == 'call':
+            return 5 if self.pc22 else 4
+        if m == 'icall':
+            return 4 if self.pc22 else 3
+        if m == 'eicall':
+            return 4
+        if m in ('ret', 'reti'):
+            return 5 if self.pc22 else 4
+        return 2
+
+    def edges(self, insn):
+        """The successors of the instruction, as (address, cycles), or the end of the path, as (None, cycles)."""
+        m = insn.mnemonic
+        following = insn.address + insn.size
+        if m in ('ret', 'reti', 'ijmp', 'eijmp'):
+            return [(None, self.cost(insn))]
+        if m in ('rjmp', 'jmp'):
+            return [(insn.target(), self.cost(insn))]
+        if m in BRANCH:
+            return [(following, 1), (insn.target(), 2)]
+        if m in SKIP:
+            skipped = self.code.get(following)
+            return [(following, 1), (following + (skipped.size if skipped else 2), 3 if skipped and skipped.size == 4 else 2)]
+        return [(following, self.cost(insn))]
+
+    def call(self, insn):
+        """The worst case of the function called by the instruction, and its notes."""
+        if insn.mnemonic in ('icall', 'eicall'):
+            return 0, {'icall'}
+        target = insn.target()
+        if target not in self.calls:
+            self.calls[target] = (None, {'recursion'})
+            memo, stops, self.memo, self.stops = self.memo, self.stops, {}, set()
+            self.calls[target] = self.longest(target)
+            self.memo, self.stops = memo, stops
+        return self.calls[target]
+
+    def shortest(self, start):
+        """The cycles of the shortest path from the resume point to the end of the thread function."""
+        best = {start: 0}
+        queue = [start]
+        result = None
+        while queue:
+            queue.sort(key=lambda a: best[a])
+            address = queue.pop(0)
+            insn = self.code.get(address)
+            if insn is None:
+                continue
+            extra = self.call(insn)[0] or 0 if insn.mnemonic in ('call', 'rcall') else 0
+            for target, cycles in self.edges(insn):
+                total = best[address] + cycles + extra
+                if target is None:
+                    result = total if result is None else min(result, total)
+                elif target not in best or total < best[target]:
+                    best[target] = total
+                    queue.append(target)
+        return result or 0
+
+    def longest(self, start, first=True):
+        """The worst-case cycles and the notes of the paths from the address to the end of the function."""
+        if not first and start in self.stops:
+            return self.shortest(start), set()
+        if start in self.memo:
+            result = self.memo[start]
+            if result is None:
+                return None, {'loop at 0x%04x' % start}
+            return result
+        insn = self.code.get(start)
+        if insn is None:
+            return 0, {'code at 0x%04x not found' % start}
+        self.memo[start] = None
+        worst, notes = 0, set()
+        if insn.mnemonic in ('call', 'rcall', 'icall', 'eicall'):
+            called, called_notes = self.call(insn)
+            notes |= called_notes
+            extra = called
+        else:
+            extra = 0
+        if insn.mnemonic in ('ijmp', 'eijmp'):
+            notes.add('ijmp')
+        for target, cycles in self.edges(insn):
+            if target is None:
+                total, target_notes = cycles, set()
+            else:
+                total, target_notes = self.longest(target, False)
+                if total is not None:
+                    total += cycles
+            notes |= target_notes
+            if total is None or extra is None or worst is None:
+                worst = None
+            else:
+                worst = max(worst, total + extra)
+        self.memo[start] = (worst, notes)
+        return worst, notes
+
+    def resume(self, entry):
+        """The worst-case cycles from the entry of the thread function to its resume jump (inclusive)."""
+        memo, stops = self.memo, self.stops
+        self.memo, self.stops = {}, set()
+        worst, notes = self.longest(entry)
+        self.memo, self.stops = memo, stops
+        return worst
+
+
+def scan_sources(paths):
+    """Map thread names to the lines of the file with their VT_BEGIN."""
+    files = {}
+    for path in paths or []:
+        with open(path, errors='replace') as f:
+            lines = f.read().splitlines()
+        for text in lines:
+            for name in THREAD_BEGIN.findall(text):
+                files.setdefault(name, lines)
+    return files
+
+
+def parse_budgets(specs):
+    budgets = {}
+    for spec in specs or []:
+        match = re.match(r'^(\w+)(?::(\w+))?=(\d+)$', spec)
+        if not match:
+            sys.exit('vt_map: invalid budget %s (expected THREAD=CYCLES or THREAD:SEGMENT=CYCLES)' % spec)
+        thread, segment, cycles = match.groups()
+        budgets[(thread, segment)] = int(cycles)
+    return budgets
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Print the yield-point map of the virtual threads.')
+    parser.add_argument('--objdump', default='avr-objdump')
+    parser.add_argument('--listing', action='store_true')
+    parser.add_argument('--pc22', action='store_true')
+    parser.add_argument('--budget', action='append')
+    parser.add_argument('--sources', action='append')
+    parser.add_argument('file')
+    args = parser.parse_args()
+    sys.setrecursionlimit(20000)
+
+    budgets = parse_budgets(args.budget)
+    files = scan_sources(args.sources)
+    symbols, code = parse_listing(read_listing(args))
+    functions = sorted((a, n, s) for a, n, s, f in symbols if f)
+    labels = sorted((a, n) for a, n, s, f in symbols if not f)
+
+    threads = []
+    for address, name in labels:
+        match = BEGIN.match(name)
+        if not match:
+            continue
+        owner = [f for f in functions if f[0] <= address < f[0] + f[2]]
+        if owner:
+            threads.append((match.group(1), owner[0]))
+
+    analyzer = Analyzer(code, args.pc22)
+    failed = False
+    print('%-16s %-8s %7s  %s' % ('thread', 'segment', 'cycles', 'notes'))
+    for thread, (entry, function, size) in threads:
+        points = []
+        stops = set()
+        for address, name in labels:
+            if not entry <= address < entry + size:
+                continue
+            match = YIELD.match(name)
+            if match:
+                points.append((address, 'L' + match.group(2), int(match.group(2))))
+                if match.group(1) == 'yield':
+                    stops.add(address)
+            elif name.startswith(thread + '__') and name != thread + '__STOP':
+                points.append((address, name[len(thread) + 2:], None))
+        analyzer.stops = stops
+        analyzer.memo = {}
+        print('%-16s %-8s %7s  %s' % (thread, 'resume', analyzer.resume(entry), 'flash=%d' % size))
+        for address, segment, line in points:
+            cycles, notes = analyzer.longest(address)
+            budget = budgets.get((thread, segment), budgets.get((thread, None)))
+            notes = sorted(notes)
+            if budget is not None and (cycles is None or cycles > budget):
+                notes.append('OVER BUDGET %d' % budget)
+                failed = True
+            if line and thread in files and line <= len(files[thread]):
+                notes.append(files[thread][line - 1].strip())
+            print('%-16s %-8s %7s  %s' % ('', segment, '-' if cycles is None else cycles, '  '.join(notes)))
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
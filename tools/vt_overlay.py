@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+#
+# Generator of the linker script fragment that overlays the persistent locals of virtual threads
+# (see include/vthreads_locals.h).
+#
+# Every argument is a group of threads that are never active at the same time;
+# the locals of the threads of a group are placed at the same address, and the group takes
+# as much RAM as its largest member. The fragment is inserted before .noinit, so the locals
+# of the threads that are not listed stay in .noinit, with storage of their own.
+#
+# Usage: vt_overlay.py GROUP... > overlay.ld
+#   GROUP  comma-separated thread names, e.g. selftest,run
+# Then link with -Wl,-T,overlay.ld
+
+import re
+import sys
+
+NAME = re.compile(r'^[A-Za-z_]\w*$')
+
+
+def main():
+    groups = [[name.strip() for name in group.split(',') if name.strip()] for group in sys.argv[1:]]
+    if not groups:
+        sys.exit('usage: vt_overlay.py GROUP... (a group is comma-separated thread names)')
+
+    seen = set()
+    for group in groups:
+        for name in group:
+            if not NAME.match(name):
+                sys.exit('invalid thread name: %s' % name)
+            if name in seen:
+                sys.exit('thread %s is listed in more than one group' % name)
+            seen.add(name)
+
+    print('/* Generated by vt_overlay.py %s */' % ' '.join(sys.argv[1:]))
+    print('SECTIONS')
+    print('{')
+    for group in groups:
+        print('  OVERLAY :')
+        print('  {')
+        for name in group:
+            print('    .vthreads.%s { *(.noinit.vthreads.%s) }' % (name, name))
+        print('  } > data')
+    print('}')
+    print('INSERT BEFORE .noinit;')
+
+
+if __name__ == '__main__':
+    main()
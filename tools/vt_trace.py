@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+#
+# Decoder of the vthreads trace ring (see include/vthreads_trace.h).
+#
+# Reads a dump made with vt_trace_dump(), oldest entry first, and prints one line per event:
+#   time   - the VT_CLOCK timestamp
+#   delta  - ticks since the previous event
+#   thread - the thread name (from VT_THREAD_ID declarations in the sources)
+#   event  - "resume" (at the line of VT_BEGIN) or "yield"
+#   where  - file:line and the source text of the resume or yield point
+#
+# Usage: vt_trace.py [--hex] [--clock-bytes N] DUMP SOURCE...
+#   --hex            the dump is text with hex bytes (e.g. captured from a terminal), not raw binary
+#   --clock-bytes N  the size of VT_CLOCK_T (default 2)
+#   DUMP             the dump file, or - for stdin
+#   SOURCE           the C sources of the virtual threads
+
+import argparse
+import re
+import sys
+
+THREAD_ID = re.compile(r'\bVT_THREAD_ID\s*\(\s*(\w+)\s*,\s*(\w+)\s*\)')
+THREAD_BEGIN = re.compile(r'\bVT_(?:ISR(?:_NAKED)?\s*\(\s*\w+\s*,|BEGIN\w*\s*\()\s*(\w+)')
+
+
+def parse_int(text):
+    try:
+        return int(text, 0)
+    except ValueError:
+        return None
+
+
+def scan_sources(paths):
+    """Map thread ids to names, and thread names to (file, lines) of the file with their VT_BEGIN."""
+    ids = {}
+    files = {}
+    for path in paths:
+        with open(path, errors='replace') as f:
+            lines = f.read().splitlines()
+        for text in lines:
+            for name, value in THREAD_ID.findall(text):
+                number = parse_int(value)
+                if number is not None:
+                    ids[number] = name
+            for name in THREAD_BEGIN.findall(text):
+                files.setdefault(name, (path, lines))
+    return ids, files
+
+
+def read_dump(source, hex_text):
+    data = sys.stdin.buffer.read() if source == '-' else open(source, 'rb').read()
+    if hex_text:
+        data = bytes(int(b, 16) for b in re.findall(rb'\b[0-9A-Fa-f]{2}\b', data))
+    return data
+
+
+def locate(files, name, line12):
+    """Find the source line whose number matches the low 12 bits of the point (files over 4095 lines are ambiguous)."""
+    if name not in files:
+        return '?', ''
+    path, lines = files[name]
+    candidates = [n for n in range(line12, len(lines) + 1, 0x1000) if n > 0]
+    if not candidates:
+        return '%s:%d?' % (path, line12), ''
+    n = candidates[0]
+    return '%s:%d' % (path, n), lines[n - 1].strip()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode a vthreads trace dump.')
+    parser.add_argument('--hex', action='store_true')
+    parser.add_argument('--clock-bytes', type=int, default=2)
+    parser.add_argument('dump')
+    parser.add_argument('sources', nargs='+')
+    args = parser.parse_args()
+
+    ids, files = scan_sources(args.sources)
+    data = read_dump(args.dump, args.hex)
+    entry = 2 + args.clock_bytes
+    clock_mask = (1 << (8 * args.clock_bytes)) - 1
+
+    previous = None
+    for offset in range(0, len(data) - entry + 1, entry):
+        point = int.from_bytes(data[offset:offset + 2], 'little')
+        if point == 0:
+            continue
+        time = int.from_bytes(data[offset + 2:offset + entry], 'little')
+        thread = point >> 12
+        name = ids.get(thread, '#%d' % thread)
+        where, text = locate(files, name, point & 0xFFF)
+        event = 'resume' if re.search(r'\bVT_(BEGIN|ISR)', text) else 'yield'
+        delta = '' if previous is None else str((time - previous) & clock_mask)
+        previous = time
+        print('%6d %6s  %-12s %-6s  %s  %s' % (time, delta, name, event, where, text))
+
+
+if __name__ == '__main__':
+    main()